@@ -0,0 +1,168 @@
+// $Id: bytecode.cpp,v 1.1 2022-02-08 09:12:30-08 - - $
+
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+#include "bytecode.h"
+#include "debug.h"
+#include "pipeline.h"
+
+static const string MAGIC {"YSHB1\n"};
+
+static void put_varint (ostream& out, size_t value) {
+   while (value >= 0x80) {
+      out.put (static_cast<char> ((value & 0x7F) | 0x80));
+      value >>= 7;
+   }
+   out.put (static_cast<char> (value));
+}
+
+static size_t get_varint (istream& in) {
+   size_t value {0};
+   for (int shift = 0; shift < 64; shift += 7) {
+      int byte = in.get();
+      if (byte == EOF) throw runtime_error ("truncated bytecode");
+      value |= static_cast<size_t> (byte & 0x7F) << shift;
+      if (not (byte & 0x80)) return value;
+   }
+   throw runtime_error ("bad varint in bytecode");
+}
+
+// class interner -
+//    Assigns each distinct string the next small integer id.
+
+class interner {
+   private:
+      unordered_map<string,size_t> ids;
+   public:
+      wordvec strings;
+      size_t operator() (const string& text) {
+         auto [found, added] = ids.try_emplace (text, strings.size());
+         if (added) strings.push_back (text);
+         return found->second;
+      }
+};
+
+void compile_script (istream& script, ostream& out) {
+   struct stage_code { size_t command; vector<size_t> words; };
+   struct line_code {
+      size_t echo;
+      size_t error;                 // id + 1, 0 if none
+      vector<stage_code> stages;
+   };
+   interner strings;
+   interner commands;
+   vector<line_code> lines;
+
+   for (;;) {
+      // Stop where the interpreter does: a last line with no newline
+      // is never run.
+      string line;
+      getline (script, line);
+      if (script.eof()) break;
+      line_code code {strings (line), 0, {}};
+      wordvec words = split (line, " \t");
+      try {
+         vector<wordvec> stages = split_pipeline (words);
+         for (const auto& stage: stages) {
+            // An empty line keeps its empty stage and fails at replay
+            // exactly where the interpreter would.
+            if (not stage.empty()) find_command_fn (stage.at(0));
+         }
+         for (const auto& stage: stages) {
+            stage_code stage_out {0, {}};
+            if (not stage.empty()) {
+               stage_out.command = commands (stage.at(0)) + 1;
+            }
+            for (const auto& word: stage) {
+               stage_out.words.push_back (strings (word));
+            }
+            code.stages.push_back (move (stage_out));
+         }
+      } catch (command_error& error) {
+         code.error = strings (error.what()) + 1;
+         code.stages.clear();
+      }
+      lines.push_back (move (code));
+   }
+   DEBUGF ('b', lines.size() << " lines, " << strings.strings.size()
+           << " strings, " << commands.strings.size() << " commands");
+
+   out << MAGIC;
+   put_varint (out, strings.strings.size());
+   for (const auto& text: strings.strings) {
+      put_varint (out, text.size());
+      out.write (text.data(), static_cast<streamsize> (text.size()));
+   }
+   put_varint (out, commands.strings.size());
+   for (const auto& name: commands.strings) {
+      put_varint (out, strings (name));
+   }
+   put_varint (out, lines.size());
+   for (const auto& code: lines) {
+      put_varint (out, code.echo);
+      put_varint (out, code.error);
+      put_varint (out, code.stages.size());
+      for (const auto& stage: code.stages) {
+         put_varint (out, stage.command);
+         put_varint (out, stage.words.size());
+         for (size_t word: stage.words) put_varint (out, word);
+      }
+   }
+}
+
+void bytecode_program::load (istream& in) {
+   string magic (MAGIC.size(), '\0');
+   in.read (magic.data(), static_cast<streamsize> (magic.size()));
+   if (magic != MAGIC) {
+      throw runtime_error ("not a yshell bytecode file");
+   }
+
+   wordvec strings (get_varint (in));
+   for (auto& text: strings) {
+      text.resize (get_varint (in));
+      in.read (text.data(), static_cast<streamsize> (text.size()));
+   }
+   auto string_at = [&] (size_t id) -> const string& {
+      if (id >= strings.size()) throw runtime_error ("bad string id");
+      return strings[id];
+   };
+   vector<command_fn> commands (get_varint (in));
+   for (auto& fn: commands) fn = find_command_fn (string_at (
+                                         get_varint (in)));
+
+   lines_.clear();
+   lines_.resize (get_varint (in));
+   for (auto& code: lines_) {
+      code.echo = string_at (get_varint (in));
+      size_t error = get_varint (in);
+      if (error > 0) code.error = string_at (error - 1);
+      code.stages.resize (get_varint (in));
+      code.fns.resize (code.stages.size());
+      for (size_t nr = 0; nr < code.stages.size(); ++nr) {
+         size_t command = get_varint (in);
+         if (command > commands.size()) {
+            throw runtime_error ("bad command id");
+         }
+         code.fns[nr] = command == 0 ? nullptr : commands[command - 1];
+         code.stages[nr].resize (get_varint (in));
+         for (auto& word: code.stages[nr]) {
+            word = string_at (get_varint (in));
+         }
+      }
+   }
+   DEBUGF ('b', lines_.size() << " lines loaded");
+}
+
+fs_status run_compiled_line (inode_state& state,
+                             const bytecode_program::line& line,
+                             vector<bool>* succeeded) {
+   if (not line.error.empty()) throw command_error (line.error);
+   for (const auto& stage: line.stages) {
+      if (stage.empty()) stage.at(0);  // same failure as split/lookup
+   }
+   return run_stages (state, line.stages, line.fns, succeeded);
+}
+
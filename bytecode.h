@@ -0,0 +1,64 @@
+// $Id: bytecode.h,v 1.1 2022-02-08 09:12:30-08 - - $
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "commands.h"
+#include "util.h"
+
+// Bytecode file layout, all integers as unsigned LEB128 varints:
+//    magic "YSHB1\n"
+//    string table:   count, then (length, bytes) per string
+//    command table:  count, then a string id per command name
+//    lines:          count, then per line:
+//       echo string id, error string id + 1 (0 if none),
+//       stage count, then per stage:
+//          command id, word count, word string ids
+// Every distinct word, command name and source line is stored once.
+
+// compile_script -
+//    Reads a script until EOF, tokenizing each line and splitting it
+//    into pipeline stages once, and writes the bytecode to out.
+//    Syntax errors are recorded on their line, to be reported when
+//    the line is replayed, just as the interpreter would.
+
+void compile_script (istream& script, ostream& out);
+
+// class bytecode_program -
+//    A loaded bytecode file.  Loading resolves each command name with
+//    find_command_fn once and builds every line's wordvecs, so replay
+//    does no tokenizing or lookups at all.
+// load -
+//    Throws a runtime_error if in is not a bytecode file.
+
+class bytecode_program {
+   public:
+      struct line {
+         string echo;
+         string error;
+         vector<wordvec> stages;
+         vector<command_fn> fns;   // nullptr: no such command
+      };
+   private:
+      vector<line> lines_;
+   public:
+      void load (istream& in);
+      const vector<line>& lines() const { return lines_; }
+};
+
+// run_compiled_line -
+//    Executes one line as run_pipeline would for its source text,
+//    throwing or returning the same errors, and setting succeeded
+//    the same way.
+
+fs_status run_compiled_line (inode_state& state,
+                        const bytecode_program::line& line,
+                        vector<bool>* succeeded = nullptr);
+
+#endif
+
@@ -1,22 +1,51 @@
 // $Id: commands.cpp,v 1.27 2022-01-28 18:11:56-08 - - $
 
+#include <algorithm>
+#include <deque>
+#include <unordered_set>
+
 #include "commands.h"
 #include "debug.h"
+#include "replica.h"
+#include "tiering.h"
 
 const command_hash cmd_hash {
    {"#"     , fn_comment},
+   {"append", fn_append },
+   {"at"    , fn_at     },
    {"cat"   , fn_cat    },
    {"cd"    , fn_cd     },
+   {"cp"    , fn_cp     },
+   {"delword", fn_delword},
+   {"df"    , fn_df     },
+   {"diff"  , fn_diff   },
    {"echo"  , fn_echo   },
    {"exit"  , fn_exit   },
+   {"export", fn_export },
+   {"head"  , fn_head   },
+   {"import", fn_import },
+   {"insert", fn_insert },
+   {"lag"   , fn_lag    },
    {"ls"    , fn_ls     },
    {"lsr"   , fn_lsr    },
    {"make"  , fn_make   },
    {"mkdir" , fn_mkdir  },
+   {"mount" , fn_mount  },
+   {"populate", fn_populate},
    {"prompt", fn_prompt },
    {"pwd"   , fn_pwd    },
+   {"quota" , fn_quota  },
    {"rm"    , fn_rm     },
    {"rmr"   , fn_rmr    },
+   {"search", fn_search },
+   {"snapshot", fn_snapshot},
+   {"sort"  , fn_sort   },
+   {"tail"  , fn_tail   },
+   {"tier"  , fn_tier   },
+   {"umount", fn_umount },
+   {"uniq"  , fn_uniq   },
+   {"watch" , fn_watch  },
+   {"wc"    , fn_wc     },
 };
 
 command_fn find_command_fn (const string& cmd) {
@@ -31,8 +60,22 @@ command_fn find_command_fn (const string& cmd) {
    return result->second;
 }
 
-command_error::command_error (const string& what):
-            runtime_error (what) {
+bool changes_tree (const string& cmd) {
+   static const unordered_set<string> changers {
+      "append", "cp", "delword", "import", "insert", "make", "mkdir",
+      "mount", "populate", "quota", "rm", "rmr", "umount",
+   };
+   return changers.count (cmd) > 0;
+}
+
+bool is_filter (const wordvec& stage) {
+   static const unordered_set<string> filters {
+      "head", "sort", "tail", "uniq", "wc",
+   };
+   if (stage.empty() or filters.count (stage.at(0)) == 0) return false;
+   // head and tail given files read them from the tree
+   size_t first = stage.size() > 1 and stage.at(1) == "-n" ? 3 : 1;
+   return first >= stage.size();
 }
 
 int exit_status_message() {
@@ -42,60 +85,195 @@ int exit_status_message() {
 }
 
 
-void fn_comment(inode_state& state, const wordvec& words) {  // 
+fs_status fn_comment(inode_state& state, const wordvec& words,
+              command_io&) {  // 
       // do nothing
    DEBUGF('c', state);
    DEBUGF('c', words);
+   return {};
+}
+
+static size_t count_arg (const string& cmd, const string& arg) {
+   // a count or word position given to cmd
+   if (arg.empty() || arg.find_first_not_of("0123456789") != string::npos) {
+      throw command_error(cmd + ": " + arg + ": not a count");
+   }
+   try {
+      return stoul(arg);
+   } catch (out_of_range&) {
+      throw command_error(cmd + ": " + arg + ": not a count");
+   }
 }
 
-void fn_cat (inode_state& state, const wordvec& words) {
+fs_status fn_append (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) {  // no args
-      throw command_error("cat: no arg(s) given");
-      return;
+      throw command_error("append: no arg(s) given");
+      return {};
+   }
+   if (words.at(1).back() == '/') {  // directory is given
+      throw command_error("append: cannot append to a directory");
+      return {};
+   }
+
+   return state.fs_append(words);
+}
+
+// The versions pinned by snapshot, by number, until snapshot -d
+// drops them.
+
+static map<size_t, shared_ptr<fs_version>> shell_versions;
+
+fs_status fn_at (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() < 3) {
+      throw command_error("at: usage: at version command...");
+      return {};
+   }
+   auto found = shell_versions.find(count_arg("at", words.at(1)));
+   if (found == shell_versions.end()) {
+      return fs_status("at: " + words.at(1) + ": no such version");
+   }
+   const string& cmd = words.at(2);
+   if (changes_tree(cmd)) {
+      throw command_error("at: " + cmd + ": versions are read-only");
+      return {};
+   }
+   if (cmd == "search") {
+      throw command_error("at: search: only the live tree is indexed");
+      return {};
+   }
+   if (cmd == "snapshot" || cmd == "watch") {
+      // they pin or watch the live tree, and snapshot -d could drop
+      // the version being run in
+      throw command_error("at: " + cmd + ": not on a version");
+      return {};
+   }
+
+   command_fn fn = find_command_fn(cmd);
+   wordvec command {words.begin() + 2, words.end()};
+   return state.run_in(*found->second, [&] {
+      return fn(state, command, io);
+   });
+}
+
+fs_status fn_cat (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   // cat -r offset count prints only that range of each file
+   bool ranged = words.size() > 1 && words.at(1) == "-r";
+   size_t first = ranged ? 4 : 1;
+   if (words.size() <= first) {  // no args
+      throw command_error(ranged ? "cat: usage: cat -r offset count file..."
+                                 : "cat: no arg(s) given");
+      return {};
    }
+   size_t offset = ranged ? count_arg("cat", words.at(2)) : 0;
+   size_t count = ranged ? count_arg("cat", words.at(3)) : SIZE_MAX;
 
-   bool first_loop = true;
-   for (auto iter = words.begin();
+   for (auto iter = words.begin() + first;
          iter != words.end(); ++iter) {
-      if (first_loop) {
-         first_loop = false;
-         continue;
-      }
-      
       if ((*iter).back() == '/') {  // directory is given
          throw command_error("cat: cannot cat a directory");
          continue;
       }
       
-      state.fs_cat(*iter);
+      fs_status status = state.fs_read("cat", *iter, offset, count, false,
+            io.out);
+      if (!status.ok()) {
+         return status;
+      }
    }
+   return {};
 }
 
-void fn_cd (inode_state& state, const wordvec& words) {
+fs_status fn_cd (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() > 2) {
       throw command_error("cd: too many params");
-      return;
+      return {};
    }
    if (words.size() == 1) {  // no args, so target is root
-      state.fs_cd("/");
-   } else {
-      state.fs_cd(words.at(1));
+      return state.fs_cd("/");
+   }
+   return state.fs_cd(words.at(1));
+}
+
+fs_status fn_cp (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   bool recursive = words.size() > 1 && words.at(1) == "-r";
+   if (words.size() != (recursive ? 4u : 3u)) {
+      throw command_error("cp: usage: cp [-r] from to");
+      return {};
+   }
+
+   return state.fs_cp(words.at(words.size() - 2), words.back(),
+         recursive);
+}
+
+fs_status fn_delword (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() < 3 || words.size() > 4) {
+      throw command_error("delword: usage: delword file pos [count]");
+      return {};
+   }
+
+   return state.fs_delword(words);
+}
+
+fs_status fn_df (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() > 2) {
+      throw command_error("df: too many params");
+      return {};
+   }
+
+   return state.fs_df(words.size() == 1 ? "." : words.at(1), io.out);
+}
+
+fs_status fn_diff (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3) {
+      throw command_error("diff: usage: diff dir dir");
+      return {};
    }
+
+   return state.fs_diff(words.at(1), words.at(2), io.out);
 }
 
-void fn_echo (inode_state& state, const wordvec& words) {
+fs_status fn_echo (inode_state& state, const wordvec& words,
+              command_io& io) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   cout << word_range (words.cbegin() + 1, words.cend()) << endl;
+   io.out << word_range (words.cbegin() + 1, words.cend()) << endl;
+   return {};
 }
 
-void fn_exit (inode_state& state, const wordvec& words) {
+fs_status fn_exit (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
@@ -109,9 +287,119 @@ void fn_exit (inode_state& state, const wordvec& words) {
       exec::status(status_val);
    }
    throw ysh_exit();
+   return {};
+}
+
+fs_status fn_export (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3) {
+      throw command_error("export: usage: export dir hostdir");
+      return {};
+   }
+
+   return state.fs_export(words.at(1), words.at(2));
+}
+
+// head and tail -
+//    With files, print the first or last count words of each one;
+//    without, they are filters on the lines of io.in.
+
+static fs_status head_tail (inode_state& state, const wordvec& words,
+              command_io& io, bool tail) {
+   const string& cmd = words.at(0);
+   size_t count = 10;
+   size_t first = 1;
+   if (words.size() > 1 && words.at(1) == "-n") {
+      if (words.size() < 3) {
+         throw command_error(cmd + ": usage: " + cmd
+               + " [-n count] [file...]");
+         return {};
+      }
+      count = count_arg(cmd, words.at(2));
+      first = 3;
+   }
+
+   if (first < words.size()) {  // files are given
+      for (auto iter = words.begin() + first;
+            iter != words.end(); ++iter) {
+         fs_status status = state.fs_read(cmd, *iter, 0, count, tail,
+               io.out);
+         if (!status.ok()) {
+            return status;
+         }
+      }
+      return {};
+   }
+
+   string line;
+   if (!tail) {
+      for (size_t nr = 0; nr < count && getline(io.in, line); ++nr) {
+         io.out << line << endl;
+      }
+      return {};
+   }
+   deque<string> last;  // only the last count lines are held
+   while (getline(io.in, line)) {
+      if (last.size() == count) {
+         if (count == 0) {
+            continue;
+         }
+         last.pop_front();
+      }
+      last.push_back(move(line));
+   }
+   for (const auto& kept: last) {
+      io.out << kept << endl;
+   }
+   return {};
 }
 
-void fn_ls (inode_state& state, const wordvec& words) {
+fs_status fn_head (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', words);
+
+   return head_tail(state, words, io, false);
+}
+
+fs_status fn_import (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3) {
+      throw command_error("import: usage: import hostdir dir");
+      return {};
+   }
+
+   return state.fs_import(words.at(1), words.at(2));
+}
+
+fs_status fn_insert (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() < 3) {
+      throw command_error("insert: usage: insert file pos words...");
+      return {};
+   }
+
+   return state.fs_insert(words);
+}
+
+fs_status fn_lag (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   return print_replication_lag(io.out);
+}
+
+fs_status fn_ls (inode_state& state, const wordvec& words,
+              command_io& io) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    DEBUGS ('l', 
@@ -123,7 +411,7 @@ void fn_ls (inode_state& state, const wordvec& words) {
 
    if (words.size() == 1) {  // if no args are given, use cwd for a
          // single call
-      state.fs_ls(".");
+      return state.fs_ls(".", io.out);
    } else {  // we have to take each arg as a target
       bool first_loop = true;
       for (auto iter = words.begin();
@@ -134,46 +422,105 @@ void fn_ls (inode_state& state, const wordvec& words) {
          }
          
          // for each target   
-         state.fs_ls(*iter);
+         fs_status status = state.fs_ls(*iter, io.out);
+         if (!status.ok()) {
+            return status;
+         }
       }
    }
+   return {};
 }
 
-void fn_lsr (inode_state& state, const wordvec& words) {
+fs_status fn_lsr (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+   return {};
 }
 
 
-void fn_make (inode_state& state, const wordvec& words) {
+fs_status fn_make (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) {  // no args
       throw command_error("make: no arg(s) given");
-      return;
+      return {};
    }
    if (words.at(1).back() == '/') {  // directory is given
       throw command_error("make: cannot make a directory");
-      return;
+      return {};
    }
 
-   state.fs_make(words);
+   return state.fs_make(words);
 }
 
-void fn_mkdir (inode_state& state, const wordvec& words) {
+fs_status fn_mkdir (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) {  // no args
       throw command_error("mkdir: no arg(s) given");
-      return;
+      return {};
+   }
+
+   return state.fs_mkdir(words.at(1));
+}
+
+fs_status fn_mount (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   // mount alone lists the mounted namespaces
+   if (words.size() == 1) {
+      state.fs_mounts(io.out);
+      return {};
+   }
+   if (words.size() > 3) {
+      throw command_error("mount: usage: mount [dir [hostdir]]");
+      return {};
    }
 
-   state.fs_mkdir(words.at(1));
+   return state.fs_mount(words.at(1), words.size() == 3 ? words.at(2) : "");
 }
 
-void fn_prompt (inode_state& state, const wordvec& words) {
+fs_status fn_populate (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   // populate [-p] dir fanout depth files words seed, where words is
+         // a count or a min-max range
+   populate_spec spec;
+   spec.parallel = words.size() > 1 && words.at(1) == "-p";
+   size_t first = spec.parallel ? 2 : 1;
+   if (words.size() != first + 6) {
+      throw command_error("populate: usage: populate [-p] dir fanout "
+            "depth files words[-maxwords] seed");
+      return {};
+   }
+   spec.fanout = count_arg("populate", words.at(first + 1));
+   spec.depth = count_arg("populate", words.at(first + 2));
+   spec.files = count_arg("populate", words.at(first + 3));
+   const string& range = words.at(first + 4);
+   size_t dash = range.find('-');
+   spec.min_words = count_arg("populate", range.substr(0, dash));
+   spec.max_words = dash == string::npos ? spec.min_words
+                  : count_arg("populate", range.substr(dash + 1));
+   spec.seed = count_arg("populate", words.at(first + 5));
+   if (spec.max_words < spec.min_words || spec.max_words == SIZE_MAX) {
+      throw command_error("populate: " + range + ": bad word range");
+      return {};
+   }
+
+   return state.fs_populate(words.at(first), spec);
+}
+
+fs_status fn_prompt (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
@@ -194,22 +541,251 @@ void fn_prompt (inode_state& state, const wordvec& words) {
    }
 
    state.prompt(new_prompt);
+   return {};
+}
+
+fs_status fn_pwd (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   state.fs_pwd(io.out);
+   return {};
+}
+
+fs_status fn_quota (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3) {
+      throw command_error("quota: usage: quota dir bytes");
+      return {};
+   }
+
+   return state.fs_quota(words.at(1), count_arg("quota", words.at(2)));
 }
 
-void fn_pwd (inode_state& state, const wordvec& words) {
+fs_status fn_rm (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   state.fs_pwd();
+   if (words.size() == 1) {  // no args
+      throw command_error("rm: no arg(s) given");
+      return {};
+   }
+   if (words.size() > 2) {
+      throw command_error("rm: too many params");
+      return {};
+   }
+
+   return state.fs_rm(words.at(1));
 }
 
-void fn_rm (inode_state& state, const wordvec& words) {
+fs_status fn_rmr (inode_state& state, const wordvec& words,
+              command_io&) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+   return {};
 }
 
-void fn_rmr (inode_state& state, const wordvec& words) {
+
+fs_status fn_search (inode_state& state, const wordvec& words,
+              command_io& io) {
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+
+   if (words.size() == 1) {  // no args
+      throw command_error("search: no word(s) given");
+      return {};
+   }
+
+   state.fs_search(words, io.out);
+   return {};
 }
 
+fs_status fn_snapshot (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {  // pin the tree as it is now
+      shared_ptr<fs_version> version = state.pin_version();
+      io.out << "version " << version->number() << endl;
+      shell_versions.emplace(version->number(), move(version));
+      return {};
+   }
+   if (words.size() == 3 && words.at(1) == "-d") {  // unpin a version
+      if (shell_versions.erase(count_arg("snapshot", words.at(2))) == 0) {
+         return fs_status("snapshot: " + words.at(2) + ": no such version");
+      }
+      return {};
+   }
+   throw command_error("snapshot: usage: snapshot [-d version]");
+   return {};
+}
+
+fs_status fn_sort (inode_state&, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', words);
+
+   wordvec lines;
+   string line;
+   while (getline(io.in, line)) {
+      lines.push_back(move(line));
+   }
+   sort(lines.begin(), lines.end());
+   for (const auto& sorted_line: lines) {
+      io.out << sorted_line << endl;
+   }
+   return {};
+}
+
+fs_status fn_tail (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', words);
+
+   return head_tail(state, words, io, true);
+}
+
+fs_status fn_tier (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (!content_tier::enabled()) {
+      return fs_status("tier: no memory budget (see -m)");
+   }
+   content_tier::print_stats(io.out);
+   return {};
+}
+
+fs_status fn_umount (inode_state& state, const wordvec& words,
+              command_io&) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 2) {
+      throw command_error("umount: usage: umount dir");
+      return {};
+   }
+
+   return state.fs_umount(words.at(1));
+}
+
+fs_status fn_uniq (inode_state&, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', words);
+
+   // only adjacent duplicates are dropped, so nothing is held
+   string prev;
+   string line;
+   bool first_line = true;
+   while (getline(io.in, line)) {
+      if (first_line || line != prev) {
+         io.out << line << endl;
+      }
+      first_line = false;
+      prev.swap(line);
+   }
+   return {};
+}
+
+// The watches started by the watch command, numbered from 1; an
+// ended one is left null so the numbers do not change.
+
+static vector<shared_ptr<event_queue>> shell_watches;
+static constexpr size_t MAX_WATCH_EVENTS {1 << 20};
+
+static size_t watch_number (const string& arg) {
+   // a watch number or queue size, or 0 if arg is not one
+   if (arg.empty() || arg.size() > 9 ||
+         arg.find_first_not_of("0123456789") != string::npos) {
+      return 0;
+   }
+   return stoul(arg);
+}
+
+fs_status fn_watch (inode_state& state, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {  // print and clear the pending events
+      vector<fs_event> events;
+      for (size_t nr = 0; nr < shell_watches.size(); ++nr) {
+         if (shell_watches[nr] == nullptr) {
+            continue;
+         }
+         events.clear();
+         shell_watches[nr]->poll(events);
+         for (const auto& event: events) {
+            io.out << "watch " << nr + 1 << ": " << event.kind;
+            if (event.kind == fs_event_kind::LOST) {
+               io.out << " events in " << event.dir_nr
+                      << ", list it again" << endl;
+            } else {
+               io.out << " " << event.name << " in " << event.dir_nr
+                      << ", inode " << event.inode_nr << endl;
+            }
+         }
+      }
+      return {};
+   }
+   if (words.size() == 3 && words.at(1) == "-d") {  // end a watch
+      size_t nr = watch_number(words.at(2));
+      if (nr == 0 || nr > shell_watches.size() ||
+            shell_watches[nr - 1] == nullptr) {
+         return fs_status("watch: " + words.at(2) + ": no such watch");
+      }
+      shell_watches[nr - 1] = nullptr;
+      return {};
+   }
+
+   bool recursive = false;
+   size_t capacity = 1024;
+   size_t arg = 1;
+   for (; arg + 1 < words.size(); ++arg) {
+      if (words.at(arg) == "-r") {
+         recursive = true;
+      } else if (words.at(arg) == "-n" && arg + 2 < words.size()) {
+         capacity = watch_number(words.at(++arg));
+      } else {
+         break;
+      }
+   }
+   if (arg + 1 != words.size() || capacity == 0 ||
+         capacity > MAX_WATCH_EVENTS) {
+      throw command_error("watch: usage: watch [-r] [-n size] dir");
+      return {};
+   }
+   inode_ptr dir = state.lookup(words.at(arg));
+   if (dir == nullptr) {
+      return fs_status("watch: no such path");
+   }
+   if (!dir->is_dir()) {
+      return fs_status("watch: path points to plain file");
+   }
+   shell_watches.push_back(state.watch(dir, recursive, capacity));
+   io.out << "watch " << shell_watches.size() << ": " << words.at(arg)
+          << (recursive ? " and below" : "") << endl;
+   return {};
+}
+
+fs_status fn_wc (inode_state&, const wordvec& words,
+              command_io& io) {
+   DEBUGF ('c', words);
+
+   size_t lines = 0;
+   size_t word_count = 0;
+   size_t chars = 0;
+   string line;
+   while (getline(io.in, line)) {
+      ++lines;
+      chars += line.size() + 1;
+      word_count += split(line, " \t").size();
+   }
+   io.out << lines << " " << word_count << " " << chars << endl;
+   return {};
+}
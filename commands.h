@@ -3,35 +3,133 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <iostream>
 #include <unordered_map>
 using namespace std;
 
 #include "file_sys.h"
 #include "util.h"
 
+// command_io -
+//    The streams a command reads from and writes to.  A command run
+//    on its own gets an empty input and cout; inside a pipeline they
+//    are connected to the neighbouring stages.
+
+struct command_io {
+   istream& in;
+   ostream& out;
+};
+
 // A couple of convenient usings to avoid verbosity.
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
+using command_fn = fs_status (*)(inode_state& state,
+                                 const wordvec& words, command_io& io);
 using command_hash = unordered_map<string,command_fn>;
 
 // execution functions -
 
-void fn_comment (inode_state& state, const wordvec& words);
-void fn_cat     (inode_state& state, const wordvec& words);
-void fn_cd      (inode_state& state, const wordvec& words);
-void fn_echo    (inode_state& state, const wordvec& words);
-void fn_exit    (inode_state& state, const wordvec& words);
-void fn_ls      (inode_state& state, const wordvec& words);
-void fn_lsr     (inode_state& state, const wordvec& words);
-void fn_make    (inode_state& state, const wordvec& words);
-void fn_mkdir   (inode_state& state, const wordvec& words);
-void fn_prompt  (inode_state& state, const wordvec& words);
-void fn_pwd     (inode_state& state, const wordvec& words);
-void fn_rm      (inode_state& state, const wordvec& words);
-void fn_rmr     (inode_state& state, const wordvec& words);
+fs_status fn_comment (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_append  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_at      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_cat     (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_cd      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_cp      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_delword (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_df      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_diff    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_echo    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_export  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_exit    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_head    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_import  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_insert  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_lag     (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_ls      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_lsr     (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_make    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_mkdir   (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_mount    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_populate (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_prompt  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_pwd     (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_quota   (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_rm      (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_rmr     (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_search  (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_snapshot (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_sort    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_tail    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_tier    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_umount   (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_uniq    (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_watch   (inode_state& state, const wordvec& words,
+                 command_io& io);
+fs_status fn_wc      (inode_state& state, const wordvec& words,
+                 command_io& io);
+
+// Filters -
+//    head, sort, tail, uniq, and wc read lines from io.in, so they
+//    are meant to be used after a "|".  Only sort holds all of its
+//    input, and tail its last lines.  head and tail given files read
+//    their first or last words instead.
+
+// snapshot and at -
+//    snapshot pins a version of the tree and prints its number, and
+//    snapshot -d drops it.  at version command... runs a command that
+//    only reads on that version, at the cwd's path in it, so a series
+//    of them sees one image however the tree changes in between.
+//    search, snapshot and watch work only on the live tree, so at
+//    refuses them.
 
 command_fn find_command_fn (const string& command);
 
+// changes_tree -
+//    Whether a command may change the tree, and so must be shipped to
+//    replication followers and refused by them.
+
+bool changes_tree (const string& command);
+
+// is_filter -
+//    Whether a pipeline stage only reads io.in and writes io.out,
+//    never touching the inode_state, so it may run alongside the
+//    other stages.
+
+bool is_filter (const wordvec& stage);
+
 // exit_status_message -
 //    Prints an exit message and returns the exit status, as recorded
 //    by any of the functions.
@@ -0,0 +1,35 @@
+#!/bin/sh
+# $Id: compare.sh,v 1.1 2022-02-16 14:27:50-08 - - $
+#
+# compare.sh binary... -
+#    Runs each yshell build on the same workload (see workload.sh),
+#    made with a different seed than PGO training used, best of three
+#    runs, and reports commands per second and the gain over the
+#    first build named.
+#
+
+passes=${PASSES:-10}
+script=$(mktemp "${TMPDIR:-/tmp}/yshell-compare-XXXXXX") || exit 1
+trap 'rm -f "$script"' EXIT
+sh "$(dirname "$0")/workload.sh" "$passes" 2 >"$script"
+commands=$(wc -l <"$script")
+echo "$commands commands, $passes passes"
+
+base=""
+for binary in "$@"; do
+   best=""
+   for run in 1 2 3; do
+      start=$(date +%s.%N)
+      "./$binary" <"$script" >/dev/null 2>&1 || echo "$binary: failed" >&2
+      end=$(date +%s.%N)
+      best=$(echo "$start $end $best" | awk '{
+         took = $2 - $1
+         print ($3 == "" || took < $3) ? took : $3
+      }')
+   done
+   [ -z "$base" ] && base=$best
+   echo "$binary $best $base $commands" | awk '{
+      printf "%-16s %8.3f s %10.0f commands/s %6.2fx\n",
+             $1, $2, $4 / $2, $3 / $2
+   }'
+done
@@ -37,10 +37,16 @@ class debugflags {
 //       DEBUGF ('u', "foo = " << foo);
 //    will print two words and a newline if flag 'u' is  on.
 //    Traces are preceded by filename, line number, and function.
+//    Under NDEBUG the traces compile to nothing, but their code is
+//    still checked, so the names it uses count as used.
 
 #ifdef NDEBUG
-#define DEBUGF(FLAG,CODE) ;
-#define DEBUGS(FLAG,STMT) ;
+#define DEBUGF(FLAG,CODE) { \
+           if (false) cerr << CODE << endl; \
+        }
+#define DEBUGS(FLAG,STMT) { \
+           if (false) { STMT; } \
+        }
 #else
 #define DEBUGF(FLAG,CODE) { \
            if (debugflags::getflag (FLAG)) { \
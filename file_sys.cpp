@@ -1,16 +1,146 @@
 // $Id: file_sys.cpp,v 1.13 2022-01-26 16:10:48-08 - - $
 
+#include <algorithm>
+#include <bit>
+#include <climits>
 #include <cassert>
+#include <filesystem>
 #include <iostream>
 #include <stdexcept>
 #include <iomanip>
+#include <unistd.h>
 
 using namespace std;
 
 #include "debug.h"
 #include "file_sys.h"
+#include "host_io.h"
 
-size_t inode::next_inode_nr {1};
+// Fixed costs charged for memory accounting, from the real object
+// sizes.  make_shared puts a 16 byte control block in front of each
+// inode (whose contents live inside it) and each file's word store,
+// and each map node carries a 32 byte red-black tree header.
+
+static constexpr size_t SHARED_BLOCK_BYTES {16};
+static constexpr size_t MAP_NODE_BYTES {32 + sizeof (dirent_type)};
+static constexpr size_t FILE_INODE_BYTES {
+      sizeof (inode) + sizeof (word_store) + 2 * SHARED_BLOCK_BYTES};
+
+// Added to the hash of a file's words, or of nothing for a new
+// directory, so an empty file and an empty directory differ.
+
+static constexpr uint64_t FILE_HASH_TAG {0x0b5e4c9d2a61f37 % HASH_PRIME};
+static constexpr uint64_t DIR_HASH_TAG {0x1c7a03e98d4b265 % HASH_PRIME};
+
+// populate recurses once per level, so its depth is bounded well
+// short of the stack.
+
+static constexpr size_t POPULATE_MAX_DEPTH {100};
+
+static size_t dirent_bytes (const string& name) {
+   return MAP_NODE_BYTES + word_store::heap_bytes (name);
+}
+
+static uint64_t splitmix64(uint64_t& state) {
+   // the next pseudo-random number after state, cheap and well mixed
+   uint64_t mixed = state += 0x9e3779b97f4a7c15;
+   mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9;
+   mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111eb;
+   return mixed ^ (mixed >> 31);
+}
+
+static wordvec populate_words(const populate_spec& spec, size_t file_nr) {
+   // the words of the file_nr'th inode of a populated tree: from
+   // min_words to max_words lowercase words of 1 to 8 letters
+
+   uint64_t state = spec.seed ^ (file_nr * 0xd1b54a32d192ed03);
+   size_t count = spec.min_words
+                + splitmix64(state) % (spec.max_words - spec.min_words + 1);
+   wordvec words(count);
+   for (auto& word: words) {
+      uint64_t bits = splitmix64(state);
+      word.resize(1 + (bits & 7));
+      bits >>= 3;
+      for (auto& letter: word) {
+         letter = static_cast<char>('a' + bits % 26);
+         bits /= 26;
+      }
+   }
+   return words;
+}
+
+static string padded_name(char prefix, size_t nr, size_t count) {
+   // prefix and nr padded to the width of count - 1, so names sort in
+   // numeric order
+
+   string digits = to_string(nr);
+   size_t width = to_string(count > 0 ? count - 1 : 0).size();
+   return prefix + string(width - digits.size(), '0') + digits;
+}
+
+static size_t saturating_add(size_t a, size_t b) {
+   return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t saturating_mul(size_t a, size_t b) {
+   return b != 0 && a > SIZE_MAX / b ? SIZE_MAX : a * b;
+}
+
+static size_t physical_memory() {
+   // bytes of memory on the host, or SIZE_MAX if it can not be told
+
+   long pages = sysconf(_SC_PHYS_PAGES);
+   long page_bytes = sysconf(_SC_PAGE_SIZE);
+   if (pages <= 0 || page_bytes <= 0) {
+      return SIZE_MAX;
+   }
+   return saturating_mul(static_cast<size_t>(pages),
+         static_cast<size_t>(page_bytes));
+}
+
+static inode_ptr up(const inode_ptr& node) {
+   // the dir above dir node in its own namespace, or nullptr at the
+         // root of one, where every walk up from a change stops
+
+   directory& dir = node->as_dir();
+   inode_ptr parent = dir.parent();
+   if (parent == node || parent->as_dir().get_space() != dir.get_space()) {
+      return nullptr;
+   }
+   return parent;
+}
+
+static bool is_below(inode_ptr node, const inode_ptr& dir) {
+   // whether dir node is dir or anywhere below it, across mounts
+   for (;;) {
+      if (node == dir) {
+         return true;
+      }
+      inode_ptr parent = node->as_dir().parent();
+      if (parent == node) {
+         return false;
+      }
+      node = parent;
+   }
+}
+
+static void tear_down(inode_ptr top) {
+   // free an unmounted tree, breaking the . and .. cycles that would
+         // keep its dirs alive; nothing else may use it by now
+
+   vector<inode_ptr> dirs {move(top)};
+   while (!dirs.empty()) {
+      inode_ptr dir = move(dirs.back());
+      dirs.pop_back();
+      dir->as_dir().release(dirs);
+   }
+}
+
+static size_t dir_inode_bytes() {
+   // a new directory holds just . and ..
+   return sizeof (inode) + SHARED_BLOCK_BYTES
+        + dirent_bytes (".") + dirent_bytes ("..");
+}
 
 ostream& operator<< (ostream& out, file_type type) {
    switch (type) {
@@ -21,16 +151,16 @@ ostream& operator<< (ostream& out, file_type type) {
    return out;
 }
 
-inode_state::inode_state() {
-   root = cwd = make_shared<inode> (file_type::DIRECTORY_TYPE);
-   directory_entries& dirents = root->get_dirents();
-   dirents.insert (dirent_type (".", root));
-   dirents.insert (dirent_type ("..", root));
+inode_state::inode_state(): root_space (make_shared<fs_namespace>()) {
+   root = cwd = directory::new_dir_inode (nullptr, root_space,
+         root_space->reserve_inode_nrs (1));
+   root_space->root = root;
    DEBUGF ('i', "root = " << root << ", cwd = " << cwd
            << ", prompt = \"" << prompt() << "\""
-           << ", file_type = " << root->contents->file_type());
+           << ", file_type = " << root->type());
 
    cwd_abs_path_str.push_back("/");
+   root->usage = dir_inode_bytes();
 }
 
 const string& inode_state::prompt() const { return prompt_; }
@@ -43,97 +173,542 @@ inode_ptr inode_state::get_cwd() {
    return cwd;
 }
 
-void inode_state::fs_ls(const string path) {
+fs_status inode_state::fs_ls(const string path, ostream& out) {
    // ls with the cwd and path to determine target 
          // (/ for root is OK though), can work max one level from cwd
    // (only works if inode points to a dir)
 
-   inode_ptr target = nullptr;
-   if (path.compare("/") == 0) {  // if call is just "/" for root
-      target = root;
-   } else {  // if call is based on cwd
-      try {
-         target = cwd->contents->get_dirents().at(path);
-      }
-      catch (out_of_range& _) {
-         throw command_error("ls: no such path");
-         return;
-      }
+   // reads through a pending cwd or target without opening either
+         // (see read_entries)
+   inode_ptr target = peek(path);
+   if (target == nullptr) {
+      return fs_status("ls: no such path");
    }
    if (path.compare(".") == 0 && cwd == root) {  // special print case
          // for "ls" in root
-      cout << "/:" << endl;
+      out << "/:" << endl;
    } else {
-      cout << path << ":" << endl;
+      out << path << ":" << endl;
    }
-   target->contents->bf_ls();
+   if (!target->is_dir()) {
+      return fs_status("is a plain file");
+   }
+   entry_view target_view {target, target->inode_nr, false};
+   entry_view parent_view {target->as_dir().parent(), 0, false};
+   parent_view.nr = parent_view.node->inode_nr;
+   if (path.compare("/") != 0 && path.compare(".") != 0 &&
+         path.compare("..") != 0) {
+      // an entry of the cwd has the cwd as its .., and in a pending
+            // cwd shows as the cwd lists it
+      parent_view = {cwd, cwd->inode_nr, false};
+      if (cwd->as_dir().shared_from != nullptr) {
+         read_entries(parent_view, parent_view,
+               [&] (const string& name, const entry_view& view) {
+            if (name == path) {
+               target_view = view;
+            }
+         });
+      }
+   }
+   read_entries(target_view, parent_view,
+         [&] (const string& name, const entry_view& view) {
+      out << std::setw(6) << view.nr << "  " << std::setw(6)
+          << view.size() << "  " << name;
+      if (view.node->is_dir()) {
+         out << "/";
+      }
+      out << endl;
+   });
+   return {};
 }
 
-void inode_state::fs_pwd() {
+void inode_state::fs_pwd(ostream& out) {
     // pwd
 
     for (auto iter = cwd_abs_path_str.begin();
            iter != cwd_abs_path_str.end(); ++iter) {
-        cout << *iter;
+        out << *iter;
         if (*iter != cwd_abs_path_str[0] && 
                iter != cwd_abs_path_str.end() - 1) {
-            cout << "/";
+            out << "/";
         }
     }
-    cout << endl;  // newline
+    out << endl;  // newline
+}
+
+inode_ptr inode_state::lookup(const string& path) {
+   // the inode path names from the cwd (or / for root), or nullptr;
+         // never throws
+
+   if (path.compare("/") == 0) {
+      return root;
+   }
+   directory_entries& dirents = cwd->get_dirents();
+   auto found = dirents.find(path);
+   return found == dirents.end() ? nullptr : found->second;
+}
+
+inode_ptr inode_state::peek(const string& path) {
+   // lookup for reading: in a pending cwd, the entry of its source,
+         // but . and .. are its own
+
+   if (path.compare("/") == 0) {
+      return root;
+   }
+   const directory& dir = cwd->as_dir();
+   const directory_entries& dirents =
+         path.compare(".") == 0 || path.compare("..") == 0
+         ? dir.dirents : dir.read_dirents();
+   auto found = dirents.find(path);
+   return found == dirents.end() ? nullptr : found->second;
+}
+
+size_t inode_state::entry_view::size() const {
+   // a hollow mount point holds only . and ..
+   return hollow ? 2 : node->size();
+}
+
+void inode_state::read_entries(const entry_view& dir,
+      const entry_view& parent,
+      const function<void(const string&, const entry_view&)>& fn) {
+   // the entries of a pending copy read as its source's: a cp -r copy
+         // numbers them in preorder from its own number, each taking
+         // as many numbers as its source has inodes (see materialize),
+         // and a version keeps their numbers, but holds a mount point
+         // empty
+
+   if (dir.hollow) {
+      fn(".", dir);
+      fn("..", parent);
+      return;
+   }
+   const directory& reading = dir.node->as_dir();
+   bool pending = reading.shared_from != nullptr;
+   bool renumbered = dir.renumbered || (pending && !reading.keep_nrs);
+   size_t next = dir.nr + 1;
+   for (const auto& entry: reading.read_dirents()) {
+      if (entry.first == ".") {
+         fn(entry.first, dir);
+         continue;
+      }
+      if (entry.first == "..") {
+         fn(entry.first, parent);
+         continue;
+      }
+      entry_view view {entry.second, entry.second->inode_nr, renumbered};
+      if (renumbered) {
+         view.nr = next;
+         next += entry.second->inodes;
+      } else if (pending && entry.second->is_dir() &&
+            entry.second->as_dir().space != reading.space) {
+         view.hollow = true;
+      }
+      fn(entry.first, view);
+   }
+}
+
+void inode_state::read_dir(inode_ptr dir, const function<void(
+      const string&, const inode_ptr&, size_t, size_t)>& fn) {
+   // read_entries from a dir's own number and its own ..
+
+   inode_ptr parent = dir->as_dir().parent();
+   read_entries({dir, dir->inode_nr, false},
+         {parent, parent->inode_nr, false},
+         [&] (const string& name, const entry_view& view) {
+      fn(name, view.node, view.nr, view.size());
+   });
+}
+
+inode_ptr inode_state::resolve(const wordvec& path) {
+   // the dir at an absolute path as kept by cwd_path ("/" first), or
+         // nullptr
+
+   inode_ptr node = root;
+   for (auto iter = path.begin() + 1; iter != path.end(); ++iter) {
+      directory* dir = node->try_dir();
+      if (dir == nullptr) {
+         return nullptr;
+      }
+      auto found = dir->get_dirents().find(*iter);
+      if (found == dir->get_dirents().end()) {
+         return nullptr;
+      }
+      node = found->second;
+   }
+   return node->is_dir() ? node : nullptr;
+}
+
+fs_status inode_state::run_at(const wordvec& path,
+      const function<fs_status()>& fn) {
+   // run fn with the cwd at path, then put the cwd back
+
+   inode_ptr dir = resolve(path);
+   if (dir == nullptr) {
+      return fs_status("no such directory: " + path.back());
+   }
+   swap(cwd, dir);
+   wordvec saved_path {path};
+   swap(cwd_abs_path_str, saved_path);
+   auto restore = [&] () {
+      cwd = dir;
+      cwd_abs_path_str = move(saved_path);
+   };
+   try {
+      fs_status status = fn();
+      restore();
+      return status;
+   } catch (...) {
+      restore();
+      throw;
+   }
 }
 
-void inode_state::fs_make(const wordvec& words) {
+shared_ptr<fs_version> inode_state::pin_version() {
+   // a pending copy of the live root, keeping its numbers; nothing is
+         // copied until a change opens it.  Not root, which run_in
+         // points at a version.
+
+   inode_ptr live = root_space->root.lock();
+   inode_ptr copy = directory::new_dir_inode(nullptr, root_space,
+         live->inode_nr);
+   copy->as_dir().share_from(live, true);
+   copy->usage = live->usage;
+   copy->hash = live->hash;
+   copy->inodes = live->inodes;
+   return make_shared<fs_version>(++versions_made, copy);
+}
+
+fs_status inode_state::run_in(const fs_version& version,
+      const function<fs_status()>& fn) {
+   // run fn with the root at version's and the cwd at the same path in
+         // it, then put both back
+
+   inode_ptr saved_root = root;
+   root = version.get_root();
+   inode_ptr dir = resolve(cwd_abs_path_str);
+   if (dir == nullptr) {
+      root = saved_root;
+      return fs_status("no such directory in version "
+            + to_string(version.number()));
+   }
+   swap(cwd, dir);
+   wordvec saved_path {cwd_abs_path_str};
+   auto restore = [&] () {
+      root = saved_root;
+      cwd = dir;
+      cwd_abs_path_str = move(saved_path);
+   };
+   try {
+      fs_status status = fn();
+      restore();
+      return status;
+   } catch (...) {
+      restore();
+      throw;
+   }
+}
+
+void inode_state::check_quota(const string& cmd, inode_ptr dir,
+      size_t growth) {
+   // throw if growing dir by growth bytes would exceed a quota on it
+         // or any dir above it; costs O(depth), never a tree walk
+
+   for (inode_ptr node = dir; node != nullptr; node = up(node)) {
+      if (node->quota > 0 && node->usage + growth > node->quota) {
+         throw command_error(cmd + ": quota of " + to_string(node->quota)
+               + " bytes exceeded");
+      }
+   }
+}
+
+void inode_state::charge(inode_ptr dir, ptrdiff_t delta,
+      ptrdiff_t inodes) {
+   // add delta bytes to the usage, and inodes to the inode count, of
+         // dir and every dir above it
+
+   for (inode_ptr node = dir; node != nullptr; node = up(node)) {
+      node->usage += delta;
+      node->inodes += inodes;
+   }
+}
+
+void inode_state::unshare_path(inode_ptr dir) {
+   // open the pending copies of dir and the dirs above it, top down,
+         // since opening a copy leaves its entries pending one level
+         // further down
+
+   vector<inode_ptr> path;
+   for (inode_ptr node = dir; node != nullptr; node = up(node)) {
+      path.push_back(node);
+   }
+   for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+      (*iter)->as_dir().unshare();
+   }
+}
+
+void inode_state::rehash(inode_ptr dir, uint64_t key,
+      uint64_t old_hash, uint64_t new_hash) {
+   // an entry of dir with name key key changed hash (0 when absent);
+         // fold the change into dir and every dir above it
+
+   for (inode_ptr node = dir;;) {
+      uint64_t before = node->hash;
+      node->hash = hash_add(node->hash,
+            hash_mul(key, hash_sub(new_hash, old_hash)));
+      inode_ptr parent = up(node);
+      if (parent == nullptr) {
+         break;
+      }
+      key = node->name_key;
+      old_hash = before;
+      new_hash = node->hash;
+      node = parent;
+   }
+}
+
+void inode_state::recharge_file(inode_ptr dir, const string& name,
+      inode_ptr file) {
+   // bring file's usage and hash, and its dirs', up to date after an
+         // edit, and tell the watches
+
+   const word_store& data = file->as_file().contents();
+   size_t now = FILE_INODE_BYTES + data.bytes();
+   ptrdiff_t delta = static_cast<ptrdiff_t>(now)
+                   - static_cast<ptrdiff_t>(file->usage);
+   file->usage = now;
+   charge(dir, delta, 0);
+   uint64_t old_hash = file->hash;
+   file->hash = hash_add(data.hash(), FILE_HASH_TAG);
+   rehash(dir, file->name_key, old_hash, file->hash);
+   notify(fs_event_kind::WRITTEN, dir, name, file);
+}
+
+void inode_state::notify(fs_event_kind kind, inode_ptr dir,
+      const string& name, inode_ptr node) {
+   // push an event about entry name of dir to the watches on dir and
+         // the recursive ones above it
+
+   watch_table& watches = dir->as_dir().get_space()->watches;
+   if (watches.empty()) {
+      return;
+   }
+   fs_event event {kind, dir->inode_nr, name, node->inode_nr};
+   for (inode_ptr at = dir; at != nullptr; at = up(at)) {
+      watches.deliver(at->inode_nr, at == dir, event);
+   }
+}
+
+shared_ptr<event_queue> inode_state::watch(inode_ptr dir,
+      bool recursive, size_t capacity) {
+   // only directories are watched
+   return dir->as_dir().get_space()->watches.subscribe(dir->inode_nr,
+         recursive, capacity);
+}
+
+inode_ptr inode_state::file_for_write(const string& cmd, inode_ptr dir,
+      const string& fn, size_t data_bytes) {
+   // arg fn: filename in dir
+   // arg data_bytes: what the caller will add to the file
+   // find the file to write, creating it (empty) if necessary, but
+         // only if the quotas leave room for its words as well
+
+   unshare_path(dir);
+   if (dir->as_dir().file_exists(fn)) {  // the file 
+         // already exists
+      return dir->get_dirents().at(fn);
+   }
+   size_t growth = FILE_INODE_BYTES + dirent_bytes(fn);
+   check_quota(cmd, dir, growth + data_bytes);
+   inode_ptr new_file = dir->as_dir().mkfile(fn);  // make new file
+   new_file->usage = FILE_INODE_BYTES;
+   charge(dir, growth, 1);
+   rehash(dir, new_file->name_key, 0, new_file->hash);
+   notify(fs_event_kind::CREATED, dir, fn, new_file);
+   return new_file;
+}
+
+size_t inode_state::word_pos(const string& cmd, const string& arg) {
+   // parse a word position or count given to cmd
+
+   if (arg.empty() || arg.find_first_not_of("0123456789") 
+         != string::npos) {
+      throw command_error(cmd + ": " + arg + ": not a word position");
+   }
+   try {
+      return stoul(arg);
+   } catch (out_of_range&) {
+      throw command_error(cmd + ": " + arg + ": not a word position");
+   }
+}
+
+fs_status inode_state::fs_make(const wordvec& words) {
    // arg words: the words inputted to fn_make
    // make
 
-   string fn = words.at(1);
+   return write_file(cwd, words.at(1), {words.begin() + 2, words.end()});
+}
+
+fs_status inode_state::write_file(inode_ptr dir, const string& name,
+      wordvec&& data) {
+   // create or replace file name in dir, taking its words
 
-   // create the file (if necessary) and get a ptr to its inode
-   inode_ptr write_file;
-   if (cwd->contents->file_exists(fn)) {  // the file 
-         // already exists
-      write_file = cwd->contents->get_dirents().at(fn);
-   } else {
-      write_file = cwd->contents->mkfile(fn);  // make new file
+   size_t data_bytes = word_store::bytes_for(data);
+   inode_ptr write_file = file_for_write("make", dir, name, data_bytes);
+   if (write_file->is_dir()) {
+      return fs_status("is a directory");
+   }
+   size_t new_usage = FILE_INODE_BYTES + data_bytes;
+   if (new_usage > write_file->usage) {
+      check_quota("make", dir, new_usage - write_file->usage);
+   }
+   word_index& word_idx = dir->as_dir().get_space()->word_idx;
+   if (word_idx.enabled()) {
+      word_idx.erase(write_file->inode_nr,
+            write_file->as_file().contents());
    }
 
    // write the data to the file
-   write_file->contents->writefile({words.begin() + 2, words.end()});
+   write_file->as_file().writefile(move(data));
+   word_idx.insert(write_file->inode_nr,
+         write_file->as_file().contents());
+   recharge_file(dir, name, write_file);
+   return {};
+}
+
+fs_status inode_state::fs_append(const wordvec& words) {
+   // arg words: the words inputted to fn_append
+   // append (only the new words are touched)
+
+   wordvec tail {words.begin() + 2, words.end()};
+   size_t tail_bytes = word_store::bytes_for(tail);
+   inode_ptr write_file = file_for_write("append", cwd, words.at(1),
+         tail_bytes);
+   if (write_file->is_dir()) {
+      return fs_status("is a directory");
+   }
+   check_quota("append", cwd, tail_bytes);
+   cwd->as_dir().get_space()->word_idx.insert(write_file->inode_nr,
+         tail);
+   write_file->as_file().appendfile(move(tail));
+   recharge_file(cwd, words.at(1), write_file);
+   return {};
 }
 
-void inode_state::fs_mkdir(const string path) {
+fs_status inode_state::fs_insert(const wordvec& words) {
+   // arg words: the words inputted to fn_insert
+   // insert (words go before the given word position)
+
+   inode_ptr write_file = words.at(1).compare("/") == 0 ? nullptr
+         : lookup(words.at(1));
+   if (write_file == nullptr) {
+      return fs_status("insert: file does not exist");
+   }
+   size_t pos = word_pos("insert", words.at(2));
+   if (write_file->is_dir()) {
+      return fs_status("is a directory");
+   }
+   if (pos > write_file->as_file().contents().size()) {
+      return fs_status("insert: word position past end of file");
+   }
+   unshare_path(cwd);
+   wordvec added {words.begin() + 3, words.end()};
+   check_quota("insert", cwd, word_store::bytes_for(added));
+   cwd->as_dir().get_space()->word_idx.insert(write_file->inode_nr,
+         added);
+   write_file->as_file().insertwords(pos, move(added));
+   recharge_file(cwd, words.at(1), write_file);
+   return {};
+}
+
+fs_status inode_state::fs_delword(const wordvec& words) {
+   // arg words: the words inputted to fn_delword
+   // delword (count defaults to one word)
+
+   inode_ptr write_file = words.at(1).compare("/") == 0 ? nullptr
+         : lookup(words.at(1));
+   if (write_file == nullptr) {
+      return fs_status("delword: file does not exist");
+   }
+   size_t pos = word_pos("delword", words.at(2));
+   size_t count = words.size() > 3 ? word_pos("delword", words.at(3))
+                                   : 1;
+   if (write_file->is_dir()) {
+      return fs_status("is a directory");
+   }
+   size_t size = write_file->as_file().contents().size();
+   if (pos > size || count > size - pos) {
+      return fs_status("delword: word range past end of file");
+   }
+   unshare_path(cwd);
+   wordvec erased = write_file->as_file().erasewords(pos, count);
+   cwd->as_dir().get_space()->word_idx.erase_missing(
+         write_file->inode_nr, erased,
+         write_file->as_file().contents());
+   recharge_file(cwd, words.at(1), write_file);
+   return {};
+}
+
+fs_status inode_state::fs_mkdir(const string path) {
    // arg words: the words inputted to fn_make
    // mkdir
+
+   return make_dir(cwd, path);
+}
+
+fs_status inode_state::make_dir(inode_ptr dir, const string& name) {
+   // make subdirectory name of dir
    
-   if (cwd->contents->file_exists(path)) {
-      throw command_error("mkdir: file (dir or plain) already at "
+   if (dir->as_dir().file_exists(name)) {
+      return fs_status("mkdir: file (dir or plain) already at "
             "given path");
-      return;
    }
 
-   inode_ptr new_dir = cwd->contents->mkdir(path, cwd);
+   size_t growth = dir_inode_bytes() + dirent_bytes(name);
+   check_quota("mkdir", dir, growth);
+   unshare_path(dir);
+   inode_ptr new_dir = dir->as_dir().mkdir(name, dir);
+   new_dir->usage = dir_inode_bytes();
+   charge(dir, growth, 1);
+   rehash(dir, new_dir->name_key, 0, new_dir->hash);
+   notify(fs_event_kind::CREATED, dir, name, new_dir);
+   return {};
 }
 
-void inode_state::fs_cat(const string fn) {
+fs_status inode_state::fs_cat(const string fn, ostream& out) {
    // arg fn: filename
    // cat (on a single file)
 
-   if (!cwd->contents->file_exists(fn)) {  // file does not exist
-      throw command_error("cat: file does not exist");
-      return;
+   return fs_read("cat", fn, 0, SIZE_MAX, false, out);
+}
+
+fs_status inode_state::fs_read(const string& cmd, const string fn,
+      size_t offset, size_t count, bool from_end, ostream& out) {
+   // arg fn: filename
+   // cat, head, tail and cat -r: count words from word offset, or the
+         // last count words, seeking straight to the first one
+
+   inode_ptr target = fn.compare("/") == 0 ? nullptr : peek(fn);
+   if (target == nullptr) {  // file does not exist
+      return fs_status(cmd + ": file does not exist");
+   }
+   plain_file* file = target->try_file();
+   if (file == nullptr) {
+      return fs_status("is a directory");
    }
 
-   wordvec data = cwd->contents->get_dirents().
-         at(fn)->contents->readfile();
-   for (auto iter = data.begin();
-         iter != data.end(); ++iter) {
-      cout << *iter << " ";
+   const word_store& data = file->readfile();
+   if (from_end) {
+      offset = data.size() - min(count, data.size());
+   }
+   auto iter = data.at(offset);
+   for (; count > 0 && iter != data.end(); ++iter, --count) {
+      out << *iter << " ";
    }
-   cout << endl;
+   out << endl;
+   return {};
 }
 
-void inode_state::fs_cd(const string path) {
+fs_status inode_state::fs_cd(const string path) {
    // arg path: path to cd to
    // cd (only to a dir contained by the cwd)
 
@@ -142,16 +717,12 @@ void inode_state::fs_cd(const string path) {
       cwd_abs_path_str.clear();
       cwd_abs_path_str.push_back("/");
    } else {
-      directory_entries dirents = cwd->contents->get_dirents();
-      if (dirents.find(path) == dirents.end()) {  // path does not 
-            // exist here
-         throw command_error("cd: bad path");
-         return;
+      inode_ptr target = lookup(path);
+      if (target == nullptr) {  // path does not exist here
+         return fs_status("cd: bad path");
       }
-      inode_ptr target = dirents.at(path);
-      if (target->contents->file_type().compare("plain file") == 0) {
-         throw command_error("cd: path points to plain file");
-         return;
+      if (!target->is_dir()) {
+         return fs_status("cd: path points to plain file");
       }
 
       // since we confirmed the target; now do the cd
@@ -165,6 +736,627 @@ void inode_state::fs_cd(const string path) {
          cwd_abs_path_str.push_back(path);
       }
    }
+   return {};
+}
+
+fs_status inode_state::fs_rm(const string path) {
+   // arg path: name of a file or empty dir contained by the cwd
+   // rm
+
+   return remove(cwd, path);
+}
+
+fs_status inode_state::remove(inode_ptr dir, const string& name) {
+   // remove file or empty subdirectory name of dir
+
+   if (name.compare(".") == 0 || name.compare("..") == 0) {
+      return fs_status("rm: cannot remove . or ..");
+   }
+   if (!dir->as_dir().file_exists(name)) {
+      return fs_status("rm: file does not exist");
+   }
+
+   unshare_path(dir);
+   inode_ptr target = dir->get_dirents().at(name);
+   fs_namespace& space = *dir->as_dir().get_space();
+   if (target->is_dir() && target->as_dir().get_space().get() != &space) {
+      return fs_status("rm: " + name + ": is a mount point");
+   }
+   if (space.word_idx.enabled() &&
+         !target->is_dir()) {
+      space.word_idx.erase(target->inode_nr,
+            target->as_file().contents());
+   }
+   fs_status status = dir->as_dir().remove(name);
+   if (!status.ok()) {
+      return status;
+   }
+   charge(dir, -static_cast<ptrdiff_t>(target->usage
+         + dirent_bytes(name)), -static_cast<ptrdiff_t>(target->inodes));
+   rehash(dir, target->name_key, target->hash, 0);
+   notify(fs_event_kind::REMOVED, dir, name, target);
+   if (target->is_dir()) {
+      space.watches.forget(target->inode_nr);
+   }
+   return {};
+}
+
+fs_status inode_state::fs_cp(const string from, const string to,
+      bool recursive) {
+   // arg from: file, or dir if recursive, to copy
+   // arg to: name of the new copy in the cwd
+   // cp (shares the contents, see unshare_path)
+
+   inode_ptr source = peek(from);
+   if (source == nullptr) {
+      return fs_status("cp: " + from + ": no such file or directory");
+   }
+   if (source->is_dir() && !recursive) {
+      return fs_status("cp: " + from + ": is a directory");
+   }
+   if (cwd->as_dir().file_exists(to)) {
+      return fs_status("cp: file (dir or plain) already at "
+            "given path");
+   }
+
+   fs_namespace& space = *cwd->as_dir().get_space();
+   inode_ptr copy;
+   size_t growth;
+   if (source->is_dir() && shares_across(source)) {
+      copy = copy_tree(source, cwd);
+      growth = copy->usage + dirent_bytes(to);
+      check_quota("cp", cwd, growth);
+   } else {
+      // a number for every inode the copy will have once opened
+      growth = source->usage + dirent_bytes(to);
+      check_quota("cp", cwd, growth);
+      size_t nr = space.reserve_inode_nrs(source->inodes);
+      if (source->is_dir()) {
+         copy = directory::new_dir_inode(cwd, cwd->as_dir().get_space(),
+               nr);
+         copy->as_dir().share_from(source);
+      } else {
+         copy = make_shared<inode>(file_type::PLAIN_TYPE, nr);
+         copy->as_file().share_from(source->as_file());
+      }
+      copy->usage = source->usage;
+      copy->hash = source->hash;
+      copy->inodes = source->inodes;
+   }
+   copy->name_key = word_hash(to);
+
+   // source may be the cwd or above it, so open the new copy down to
+         // the cwd before adding to it
+   unshare_path(cwd);
+   cwd->get_dirents().insert({to, copy});
+   charge(cwd, growth, static_cast<ptrdiff_t>(copy->inodes));
+   rehash(cwd, copy->name_key, 0, copy->hash);
+   notify(fs_event_kind::CREATED, cwd, to, copy);
+
+   if (space.word_idx.enabled()) {
+      // index every copied file under the number it shows, in
+            // preorder, so each insert appends to the postings, and
+            // without opening the copy
+      function<void(const entry_view&)> index =
+            [&] (const entry_view& view) {
+         if (!view.node->is_dir()) {
+            space.word_idx.insert(view.nr, view.node->as_file().contents());
+            return;
+         }
+         read_entries(view, view,
+               [&] (const string& name, const entry_view& entry) {
+            if (name != "." && name != "..") {
+               index(entry);
+            }
+         });
+      };
+      index({copy, copy->inode_nr, false});
+   }
+   return {};
+}
+
+bool inode_state::shares_across(inode_ptr source) {
+   // whether a pending copy of dir source in the cwd would share
+         // entries across namespaces: source is in another one, or one
+         // is mounted below it; costs O(mounts * depth)
+
+   if (source->as_dir().get_space() != cwd->as_dir().get_space()) {
+      return true;
+   }
+   for (const auto& space: mounts) {
+      if (is_below(space->root.lock(), source)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+inode_ptr inode_state::copy_tree(inode_ptr source, inode_ptr parent) {
+   // a copy of dir source, built at once in parent's namespace; files
+         // still share their words, and usage and hash are summed on
+         // the way back up as for import
+
+   inode_ptr dir = directory::new_dir_inode(parent);
+   fs_namespace& space = *dir->as_dir().get_space();
+   directory_entries& dirents = dir->get_dirents();
+   dir->usage = dir_inode_bytes();
+   for (const auto& entry: source->as_dir().read_dirents()) {
+      if (entry.first == "." || entry.first == "..") {
+         continue;
+      }
+      inode_ptr node;
+      if (entry.second->is_dir()) {
+         node = copy_tree(entry.second, dir);
+      } else {
+         node = make_shared<inode>(file_type::PLAIN_TYPE,
+               space.reserve_inode_nrs(1));
+         node->as_file().share_from(entry.second->as_file());
+         node->usage = entry.second->usage;
+         node->hash = entry.second->hash;
+      }
+      node->name_key = entry.second->name_key;
+      dir->usage += node->usage + dirent_bytes(entry.first);
+      dir->inodes += node->inodes;
+      dir->hash = hash_add(dir->hash,
+            hash_mul(node->name_key, node->hash));
+      dirents.emplace_hint(dirents.end(), entry.first, node);
+   }
+   return dir;
+}
+
+fs_status inode_state::fs_import(const string host, const string path) {
+   // arg host: directory on the host to read
+   // arg path: name of the new dir to create in the cwd
+   // import
+
+   if (cwd->as_dir().file_exists(path)) {
+      return fs_status("import: file (dir or plain) already at "
+            "given path");
+   }
+
+   host_entry tree = read_host_tree("import", host);
+   inode_ptr new_dir = directory::new_dir_inode(cwd);
+   import_entries(new_dir, tree);
+   size_t growth = new_dir->usage + dirent_bytes(path);
+   check_quota("import", cwd, growth);
+   unshare_path(cwd);
+   new_dir->name_key = word_hash(path);
+   cwd->get_dirents().insert({path, new_dir});
+   charge(cwd, growth, static_cast<ptrdiff_t>(new_dir->inodes));
+   rehash(cwd, new_dir->name_key, 0, new_dir->hash);
+   index_tree(new_dir);
+   notify(fs_event_kind::CREATED, cwd, path, new_dir);
+   return {};
+}
+
+void inode_state::import_entries(inode_ptr dir, host_entry& tree) {
+   // build the inodes for tree's entries under dir, in name order so
+         // inode numbers are deterministic and every insert lands at
+         // the end of the map; usage and hash are summed on the way
+         // back up, and the words are indexed once the tree is attached
+
+   fs_namespace& space = *dir->as_dir().get_space();
+   directory_entries& dirents = dir->get_dirents();
+   dir->usage = dir_inode_bytes();
+   for (auto& entry: tree.entries) {
+      inode_ptr node;
+      if (entry.is_dir) {
+         node = directory::new_dir_inode(dir);
+         import_entries(node, entry);
+      } else {
+         node = make_shared<inode>(file_type::PLAIN_TYPE,
+               space.reserve_inode_nrs(1));
+         node->as_file().writefile(move(entry.words));
+         node->usage = FILE_INODE_BYTES 
+                     + node->as_file().contents().bytes();
+         node->hash = hash_add(node->as_file().contents().hash(),
+               FILE_HASH_TAG);
+      }
+      node->name_key = word_hash(entry.name);
+      dir->usage += node->usage + dirent_bytes(entry.name);
+      dir->inodes += node->inodes;
+      dir->hash = hash_add(dir->hash,
+            hash_mul(node->name_key, node->hash));
+      dirents.emplace_hint(dirents.end(), move(entry.name), node);
+   }
+}
+
+void inode_state::index_tree(inode_ptr dir) {
+   // add the words of every file under dir, a tree built off to the
+         // side and just attached, to its namespace's word index, in
+         // inode order so each insert appends to the postings
+
+   word_index& word_idx = dir->as_dir().get_space()->word_idx;
+   if (!word_idx.enabled()) {
+      return;
+   }
+   vector<inode_ptr> files;
+   function<void(const inode_ptr&)> walk = [&] (const inode_ptr& node) {
+      for (const auto& entry: node->get_dirents()) {
+         if (entry.first == "." || entry.first == "..") {
+            continue;
+         }
+         if (entry.second->is_dir()) {
+            walk(entry.second);
+         } else {
+            files.push_back(entry.second);
+         }
+      }
+   };
+   walk(dir);
+   sort(files.begin(), files.end(),
+         [] (const inode_ptr& a, const inode_ptr& b) {
+            return a->inode_nr < b->inode_nr;
+         });
+   for (const auto& file: files) {
+      word_idx.insert(file->inode_nr, file->as_file().contents());
+   }
+}
+
+fs_status inode_state::fs_populate(const string path,
+      const populate_spec& spec) {
+   // arg path: name of the new dir to create in the cwd
+   // populate (builds the tree off to the side like import)
+
+   if (cwd->as_dir().file_exists(path)) {
+      return fs_status("populate: file (dir or plain) already at "
+            "given path");
+   }
+
+   // the fewest bytes the tree can take, from its shape alone, so a
+   // tree that could not fit in memory, or would exceed a quota, fails
+   // before anything is built; deep trees are refused since each level
+   // is a level of recursion
+   if (spec.depth > POPULATE_MAX_DEPTH) {
+      return fs_status("populate: deeper than "
+            + to_string(POPULATE_MAX_DEPTH) + " levels");
+   }
+   size_t dirs = 0;
+   size_t level_dirs = 1;
+   for (size_t level = 0; level <= spec.depth && level_dirs > 0;
+         ++level) {
+      dirs = saturating_add(dirs, level_dirs);
+      level_dirs = saturating_mul(level_dirs, spec.fanout);
+   }
+   size_t file_bytes = saturating_add(FILE_INODE_BYTES + dirent_bytes("f"),
+         saturating_mul(spec.min_words, sizeof (string)));
+   size_t least = saturating_add(
+         saturating_mul(dirs, dir_inode_bytes() + dirent_bytes("d")),
+         saturating_mul(saturating_mul(dirs, spec.files), file_bytes));
+   if (least > physical_memory()) {
+      return fs_status("populate: tree is too large");
+   }
+   check_quota("populate", cwd, least);
+
+   // inodes in a subtree at each level, so every inode can be
+   // numbered before any is built, and subtrees built in parallel get
+   // the same numbers as when built in order
+   vector<size_t> subtree(spec.depth + 1, 1 + spec.files);
+   for (size_t level = spec.depth; level-- > 0;) {
+      subtree[level] += spec.fanout * subtree[level + 1];
+   }
+   size_t first_nr = cwd->as_dir().get_space()->reserve_inode_nrs(
+         subtree[0]);
+   inode_ptr new_dir = populate_dir(cwd, spec, subtree, 0, first_nr,
+         first_nr);
+   size_t growth = new_dir->usage + dirent_bytes(path);
+   check_quota("populate", cwd, growth);
+   unshare_path(cwd);
+   new_dir->name_key = word_hash(path);
+   cwd->get_dirents().insert({path, new_dir});
+   charge(cwd, growth, static_cast<ptrdiff_t>(new_dir->inodes));
+   rehash(cwd, new_dir->name_key, 0, new_dir->hash);
+   index_tree(new_dir);
+   notify(fs_event_kind::CREATED, cwd, path, new_dir);
+   return {};
+}
+
+inode_ptr inode_state::populate_dir(inode_ptr parent,
+      const populate_spec& spec, const vector<size_t>& subtree,
+      size_t level, size_t first_nr, size_t inode_nr) {
+   // build a dir of a populated tree numbered inode_nr, its files
+         // numbered next and then its subtrees; subdirs ("d...") sort
+         // before files ("f..."), so every insert lands at the end of
+         // the map; usage and hash are summed on the way back up
+
+   const shared_ptr<fs_namespace>& space = parent->as_dir().get_space();
+   inode_ptr dir = directory::new_dir_inode(parent, space, inode_nr);
+   vector<inode_ptr> files(spec.files);
+   for (size_t nr = 0; nr < spec.files; ++nr) {
+      size_t file_nr = inode_nr + 1 + nr;
+      files[nr] = make_shared<inode>(file_type::PLAIN_TYPE, file_nr);
+      wordvec words = populate_words(spec, file_nr - first_nr);
+      plain_file& file = files[nr]->as_file();
+      file.writefile(move(words));
+      files[nr]->usage = FILE_INODE_BYTES + file.contents().bytes();
+      files[nr]->hash = hash_add(file.contents().hash(), FILE_HASH_TAG);
+   }
+   size_t fanout = level < spec.depth ? spec.fanout : 0;
+   vector<inode_ptr> subdirs(fanout);
+   auto build = [&] (size_t nr) {
+      subdirs[nr] = populate_dir(dir, spec, subtree, level + 1, first_nr,
+            inode_nr + 1 + spec.files + nr * subtree[level + 1]);
+   };
+   if (level == 0 && spec.parallel) {
+      parallel_for(fanout, build);
+   } else {
+      for (size_t nr = 0; nr < fanout; ++nr) {
+         build(nr);
+      }
+   }
+
+   directory_entries& dirents = dir->get_dirents();
+   dir->usage = dir_inode_bytes();
+   auto enter = [&] (string name, const inode_ptr& node) {
+      node->name_key = word_hash(name);
+      dir->usage += node->usage + dirent_bytes(name);
+      dir->inodes += node->inodes;
+      dir->hash = hash_add(dir->hash,
+            hash_mul(node->name_key, node->hash));
+      dirents.emplace_hint(dirents.end(), move(name), node);
+   };
+   for (size_t nr = 0; nr < fanout; ++nr) {
+      enter(padded_name('d', nr, fanout), subdirs[nr]);
+   }
+   for (size_t nr = 0; nr < spec.files; ++nr) {
+      enter(padded_name('f', nr, spec.files), files[nr]);
+   }
+   return dir;
+}
+
+fs_status inode_state::fs_export(const string path, const string host) {
+   // arg path: name of a dir in the cwd
+   // arg host: directory on the host to write (created if needed)
+   // export
+
+   inode_ptr target = path.compare("/") == 0 ? nullptr : peek(path);
+   if (target == nullptr) {
+      return fs_status("export: bad path");
+   }
+   if (!target->is_dir()) {
+      return fs_status("export: path points to plain file");
+   }
+
+   // make the directories serially, then write the files in parallel
+   vector<host_file> files;
+   error_code error;
+   function<void(inode_ptr, const filesystem::path&)> walk =
+         [&] (inode_ptr dir, const filesystem::path& host_dir) {
+      filesystem::create_directories(host_dir, error);
+      if (error) {
+         throw command_error("export: " + host_dir.string() + ": "
+               + error.message());
+      }
+      for (const auto& entry: dir->as_dir().read_dirents()) {
+         if (entry.first == "." || entry.first == "..") {
+            continue;
+         }
+         if (entry.second->is_dir()) {
+            walk(entry.second, host_dir / entry.first);
+         } else {
+            files.push_back({(host_dir / entry.first).string(),
+                  &entry.second->as_file().readfile()});
+         }
+      }
+   };
+   walk(target, host);
+   write_host_files("export", files);
+   return {};
+}
+
+fs_status inode_state::fs_quota(const string path, size_t bytes) {
+   // arg bytes: the new quota, 0 for none
+   // quota (only on directories)
+
+   inode_ptr target = lookup(path);
+   if (target == nullptr) {
+      return fs_status("quota: no such path");
+   }
+   if (!target->is_dir()) {
+      return fs_status("quota: path points to plain file");
+   }
+   target->quota = bytes;
+   return {};
+}
+
+fs_status inode_state::fs_df(const string path, ostream& out) {
+   // df: usage and quota of a dir and of each dir directly in it,
+         // read from the running totals
+
+   inode_ptr target = peek(path);
+   if (target == nullptr) {
+      return fs_status("df: no such path");
+   }
+   if (!target->is_dir()) {
+      return fs_status("df: path points to plain file");
+   }
+   auto print = [&out] (inode_ptr node, const string& name) {
+      out << std::setw(10) << node->usage << "  " << std::setw(10);
+      if (node->quota > 0) {
+         out << node->quota;
+      } else {
+         out << "-";
+      }
+      out << "  " << name << endl;
+   };
+   print(target, path);
+   for (const auto& entry: target->as_dir().read_dirents()) {
+      if (entry.first == "." || entry.first == ".." ||
+            !entry.second->is_dir()) {
+         continue;
+      }
+      print(entry.second, entry.first + "/");
+   }
+   return {};
+}
+
+fs_status inode_state::fs_diff(const string left, const string right,
+      ostream& out) {
+   // diff: the names that differ between two dirs, skipping every
+         // pair of subtrees whose hashes match
+
+   inode_ptr left_dir = peek(left);
+   inode_ptr right_dir = peek(right);
+   if (left_dir == nullptr || right_dir == nullptr) {
+      return fs_status("diff: no such path");
+   }
+   if (!left_dir->is_dir() || !right_dir->is_dir()) {
+      return fs_status("diff: path points to plain file");
+   }
+   diff_dirs(left_dir, right_dir, left, right, out);
+   return {};
+}
+
+void inode_state::diff_dirs(inode_ptr left, inode_ptr right,
+      const string& left_path, const string& right_path,
+      ostream& out) {
+   // merge the two sorted entry maps, descending only into dirs that
+         // differ
+
+   if (left->hash == right->hash) {
+      return;
+   }
+   const directory_entries& left_dirents = left->as_dir().read_dirents();
+   const directory_entries& right_dirents =
+         right->as_dir().read_dirents();
+   auto left_iter = left_dirents.begin();
+   auto right_iter = right_dirents.begin();
+   while (left_iter != left_dirents.end() ||
+         right_iter != right_dirents.end()) {
+      int order = left_iter == left_dirents.end() ? 1
+                : right_iter == right_dirents.end() ? -1
+                : left_iter->first.compare(right_iter->first);
+      if (order < 0) {
+         out << "Only in " << left_path << ": " << left_iter->first
+             << endl;
+         ++left_iter;
+         continue;
+      }
+      if (order > 0) {
+         out << "Only in " << right_path << ": " << right_iter->first
+             << endl;
+         ++right_iter;
+         continue;
+      }
+      const string& name = left_iter->first;
+      inode_ptr left_node = left_iter->second;
+      inode_ptr right_node = right_iter->second;
+      ++left_iter;
+      ++right_iter;
+      if (name == "." || name == ".." ||
+            left_node->hash == right_node->hash) {
+         continue;
+      }
+      if (left_node->is_dir() && right_node->is_dir()) {
+         diff_dirs(left_node, right_node, left_path + "/" + name,
+               right_path + "/" + name, out);
+      } else {
+         out << (left_node->is_dir() || right_node->is_dir()
+                 ? "Types of " : "Files ")
+             << left_path << "/" << name << " and "
+             << right_path << "/" << name << " differ" << endl;
+      }
+   }
+}
+
+fs_status inode_state::fs_mount(const string path, const string host) {
+   // arg path: name of the mount point to create in the cwd
+   // arg host: directory on the host to fill it from, or empty
+   // mount (builds the namespace off to the side like import)
+
+   if (cwd->as_dir().file_exists(path)) {
+      return fs_status("mount: file (dir or plain) already at "
+            "given path");
+   }
+
+   auto space = make_shared<fs_namespace>();
+   space->word_idx.enable(root_space->word_idx.enabled());
+   inode_ptr new_root = directory::new_dir_inode(cwd, space,
+         space->reserve_inode_nrs(1));
+   new_root->usage = dir_inode_bytes();
+   if (!host.empty()) {
+      host_entry tree = read_host_tree("mount", host);
+      import_entries(new_root, tree);
+   }
+
+   // the cwd counts only the entry, and a hash no other dir has, since
+         // changes below the mount point never reach it
+   size_t growth = dirent_bytes(path);
+   check_quota("mount", cwd, growth);
+   unshare_path(cwd);
+   new_root->name_key = word_hash(path);
+   space->root = new_root;
+   space->mount_hash = word_hash("mount " + to_string(++mounts_made));
+   for (auto iter = cwd_abs_path_str.begin() + 1;
+         iter != cwd_abs_path_str.end(); ++iter) {
+      space->mount_path += "/" + *iter;
+   }
+   space->mount_path += "/" + path;
+   cwd->get_dirents().insert({path, new_root});
+   charge(cwd, growth, 0);
+   rehash(cwd, new_root->name_key, 0, space->mount_hash);
+   index_tree(new_root);
+   notify(fs_event_kind::CREATED, cwd, path, new_root);
+   mounts.push_back(move(space));
+   return {};
+}
+
+fs_status inode_state::fs_umount(const string path) {
+   // arg path: name of a mount point in the cwd
+   // umount (unlinks the namespace in O(1), and leaves freeing its
+         // inodes to a thread of its own)
+
+   inode_ptr target = lookup(path);
+   auto found = find_if(mounts.begin(), mounts.end(),
+         [&] (const shared_ptr<fs_namespace>& space) {
+      return target != nullptr && space->root.lock() == target;
+   });
+   if (found == mounts.end()) {
+      return fs_status("umount: " + path + ": not a mount point");
+   }
+   if (is_below(cwd, target)) {
+      return fs_status("umount: " + path + ": the cwd is in it");
+   }
+   for (const auto& space: mounts) {
+      inode_ptr other = space->root.lock();
+      if (other != target && is_below(other, target)) {
+         return fs_status("umount: " + path + ": "
+               + space->mount_path + " is mounted in it");
+      }
+   }
+
+   unshare_path(cwd);
+   cwd->get_dirents().erase(path);
+   charge(cwd, -static_cast<ptrdiff_t>(dirent_bytes(path)), 0);
+   rehash(cwd, target->name_key, (*found)->mount_hash, 0);
+   notify(fs_event_kind::REMOVED, cwd, path, target);
+   mounts.erase(found);
+   erase_if(reapers, [] (const future<void>& reaper) {
+      return reaper.wait_for(chrono::seconds(0)) == future_status::ready;
+   });
+   reapers.push_back(async(launch::async, tear_down, move(target)));
+   return {};
+}
+
+void inode_state::fs_mounts(ostream& out) {
+   // mount: the usage and place of each mounted namespace
+   for (const auto& space: mounts) {
+      out << std::setw(10) << space->root.lock()->usage << "  "
+          << space->mount_path << endl;
+   }
+}
+
+void inode_state::fs_search(const wordvec& words, ostream& out) {
+   // arg words: the words inputted to fn_search
+   // search (answered from the word index alone)
+
+   word_index& word_idx = cwd->as_dir().get_space()->word_idx;
+   if (!word_idx.enabled()) {
+      throw command_error("search: word index is not enabled");
+      return;
+   }
+
+   out << word_idx.search({words.begin() + 1, words.end()}) << endl;
 }
 
 ostream& operator<< (ostream& out, const inode_state& state) {
@@ -173,130 +1365,283 @@ ostream& operator<< (ostream& out, const inode_state& state) {
    return out;
 }
 
-inode::inode(file_type type): inode_nr (next_inode_nr++) {
+inode::inode(file_type type, size_t inode_nr_): inode_nr (inode_nr_) {
    switch (type) {
       case file_type::PLAIN_TYPE:
-           contents = make_shared<plain_file>();
+           // the variant starts out as a plain_file
+           hash = FILE_HASH_TAG;
            break;
       case file_type::DIRECTORY_TYPE:
-           contents = make_shared<directory>();
+           contents.emplace<directory>();
+           hash = DIR_HASH_TAG;
            break;
       default: assert (false);
    }
    DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
 }
 
+fs_version::~fs_version() {
+   tear_down(move(root));
+}
+
+size_t fs_namespace::reserve_inode_nrs(size_t count) {
+   size_t first = next_inode_nr;
+   next_inode_nr += count;
+   return first;
+}
+
 size_t inode::get_inode_nr() const {
    DEBUGF ('i', "inode = " << inode_nr);
    return inode_nr;
 }
 
-directory_entries& inode::get_dirents() {
-   return contents->get_dirents();
-}
-
-const string& inode::get_file_type() {
-   return contents->file_type();
+void inode::wrong_type() const {
+   throw file_error (is_dir() ? "is a directory" : "is a plain file");
 }
 
-size_t inode::size() {
+size_t inode::size() const {
    // return the "size" of this inode, for a dir thats how many elements
          // for a file thats how many chars
 
-   return contents->size();
+   if (is_dir()) {
+      return get_if<directory>(&contents)->size();
+   }
+   return get_if<plain_file>(&contents)->size();
 }
 
 
-
+
+command_error::command_error (const string& what):
+            runtime_error (what) {
+}
+
 file_error::file_error (const string& what):
             runtime_error (what) {
 }
 
-const wordvec& base_file::readfile() const {
-   throw file_error ("is a " + file_type());
+size_t plain_file::size() const {
+   // total chars + spaces between the words, kept by the store
+   if (data->empty()) {
+      return 0;
+   }
+   return data->chars() + data->size() - 1;
 }
 
-void base_file::writefile (const wordvec&) {
-   throw file_error ("is a " + file_type());
+void plain_file::share_from (const plain_file& source) {
+   data = source.data;
 }
 
-void base_file::remove (const string&) {
-   throw file_error ("is a " + file_type());
+word_store& plain_file::own() {
+   // copy the words before the first edit of shared ones
+   content_tier::touch(*data);
+   if (data.use_count() > 1) {
+      data = make_shared<word_store>(*data);
+   }
+   return *data;
 }
 
-inode_ptr base_file::mkdir (const string&, inode_ptr) {
-   throw file_error ("is a " + file_type());
+const word_store& plain_file::readfile() {
+   DEBUGF ('i', data->size() << " words");
+   content_tier::touch(*data);
+   return *data;
 }
 
-inode_ptr base_file::mkfile (const string&) {
-   throw file_error ("is a " + file_type());
+const word_store& plain_file::contents() {
+   content_tier::page_in(*data);
+   return *data;
 }
 
-directory_entries& base_file::get_dirents() {
-   throw file_error ("is a " + file_type());
+void plain_file::writefile (wordvec words) {
+   // arg words: the new contents, taken by value so the caller may
+         // move them in
+
+   DEBUGF ('i', words);
+
+   // write data, dropping rather than copying shared old words
+   if (data.use_count() > 1) {
+      data = make_shared<word_store>();
+   }
+   data->assign(move(words));
 }
 
-bool base_file::file_exists(const string&) {
-   throw file_error("is a " + file_type());
+void plain_file::appendfile (wordvec&& words) {
+   DEBUGF ('i', words);
+   own().append(move(words));
 }
 
+void plain_file::insertwords (size_t pos, wordvec&& words) {
+   DEBUGF ('i', pos << ": " << words);
+   if (pos > data->size()) {
+      throw file_error ("word position " + to_string(pos)
+            + " is past the end of the file");
+   }
+   own().insert(pos, move(words));
+}
 
-void base_file::bf_ls() {
-   throw file_error("is a " + file_type());
+wordvec plain_file::erasewords (size_t pos, size_t count) {
+   DEBUGF ('i', pos << ", " << count);
+   if (pos > data->size() || count > data->size() - pos) {
+      throw file_error ("word range is past the end of the file");
+   }
+   return own().erase(pos, count);
 }
 
 
-
-size_t plain_file::size() const {
-   
-   // add up the total chars + spaces from the data field
-   size_t sum = 0;
-   for (auto iter = data.begin();
-         iter != data.end(); ++iter) {
-      sum += (*iter).length() + 1;
+size_t directory::size() const {
+   // a pending copy has as many entries as its source
+   if (shared_from != nullptr) {
+      return shared_from->size();
    }
-   if (sum > 0) {
-      sum -= 1;
+   return dirents.size();
+}
+
+void directory::share_from (inode_ptr source, bool keep_nrs_) {
+   // a copy of a pending copy shares the same source, and numbers
+         // its entries as that copy would
+   directory& source_dir = source->as_dir();
+   if (source_dir.shared_from != nullptr) {
+      share_from(source_dir.shared_from,
+            keep_nrs_ && source_dir.keep_nrs);
+      return;
    }
-   
-   return sum;
+   shared_from = source;
+   keep_nrs = keep_nrs_;
+   vector<weak_ptr<inode>>& lent = source_dir.borrowers;
+   if (has_single_bit(lent.size())) {  // drop the stale ones now and then
+      erase_if(lent, [] (const weak_ptr<inode>& borrower) {
+         inode_ptr node = borrower.lock();
+         return node == nullptr || node->as_dir().shared_from == nullptr;
+      });
+   }
+   lent.push_back(dirents.at("."));
 }
 
-const wordvec& plain_file::readfile() const {
-   DEBUGF ('i', data);
-   return data;
+void directory::materialize() {
+   // copy the entries of shared_from: files share its words, and dirs
+         // become pending copies of its dirs; unless they keep their
+         // numbers, each takes the next of the numbers cp -r reserved,
+         // and as many more as its subtree has inodes, for its own
+         // entries once it is opened in turn
+
+   inode_ptr source = move(shared_from);
+   inode_ptr self = dirents.at(".");
+   DEBUGF ('i', "copy of inode " << source->get_inode_nr());
+   source->as_dir().forget_borrower(self);
+   size_t next = self->inode_nr + 1;
+   for (const auto& entry: source->get_dirents()) {
+      if (entry.first == "." || entry.first == "..") {
+         continue;
+      }
+      size_t nr = keep_nrs ? entry.second->inode_nr : next;
+      next += entry.second->inodes;
+      inode_ptr copy;
+      if (!entry.second->is_dir()) {
+         copy = make_shared<inode>(file_type::PLAIN_TYPE, nr);
+         copy->as_file().share_from(entry.second->as_file());
+         copy->usage = entry.second->usage;
+         copy->hash = entry.second->hash;
+      } else if (entry.second->as_dir().space != space) {
+         // only a version meets a mount point (cp copies those at
+               // once), and holds it empty
+         copy = new_dir_inode(self, space, nr);
+         copy->usage = dir_inode_bytes();
+      } else {
+         copy = new_dir_inode(self, space, nr);
+         copy->as_dir().share_from(entry.second, keep_nrs);
+         copy->usage = entry.second->usage;
+         copy->hash = entry.second->hash;
+         copy->inodes = entry.second->inodes;
+      }
+      copy->name_key = entry.second->name_key;
+      dirents.emplace_hint(dirents.end(), entry.first, copy);
+   }
 }
 
-void plain_file::writefile (const wordvec& words) {
-   // arg words: same as arg to fn_make, first 2 words are thus not
-         // to be written
-   // MEMLEAK FROM NOT FREEING THE OLD DATA?
-   // CONSIDER: IS MAKING A NEW VECTOR OVER THE SAME SUB-ELEMENTS OK?
+void directory::unshare() {
+   vector<weak_ptr<inode>> lent = move(borrowers);
+   borrowers.clear();
+   for (const auto& borrower: lent) {
+      inode_ptr node = borrower.lock();
+      if (node != nullptr && node->as_dir().shared_from != nullptr) {
+         node->as_dir().materialize();
+      }
+   }
+}
 
-   DEBUGF ('i', words);
+void directory::forget_borrower(const inode_ptr& borrower) {
+   // a weak_ptr to a dead copy still holds the copy's memory, which
+         // make_shared allocated along with its count
+   erase_if(borrowers, [&] (const weak_ptr<inode>& lent) {
+      return lent.expired() || lent.lock() == borrower;
+   });
+   if (borrowers.empty()) {
+      borrowers.shrink_to_fit();
+   }
+}
+
+fs_status directory::remove (const string& filename) {
+   DEBUGF ('i', filename);
 
-   // write data
-   data = words;
+   directory_entries& entries = get_dirents();
+   auto found = entries.find(filename);
+   if (found == entries.end()) {
+      return fs_status (filename + ": no such file or directory");
+   }
+   inode_ptr target = found->second;
+   if (target->is_dir() &&
+         target->size() > 2) {  // more than . and ..
+      return fs_status (filename + ": directory not empty");
+   }
+   if (target->is_dir()) {
+      // open the copies pending on it, then break the . cycle so the
+            // inode can be freed
+      target->as_dir().unshare();
+      target->get_dirents().clear();
+   }
+   entries.erase(found);
+   return {};
 }
 
+inode_ptr directory::new_dir_inode (inode_ptr parent) {
+   const shared_ptr<fs_namespace>& space = parent->as_dir().space;
+   return new_dir_inode(parent, space, space->reserve_inode_nrs(1));
+}
 
-size_t directory::size() const {
-   return dirents.size();
+inode_ptr directory::new_dir_inode (inode_ptr parent,
+      shared_ptr<fs_namespace> space, size_t inode_nr) {
+   // with no parent, a root, which is its own parent
+   inode_ptr new_inode = make_shared<inode>(file_type::DIRECTORY_TYPE,
+         inode_nr);
+   directory& new_dir = new_inode->as_dir();
+   new_dir.space = move(space);
+   new_dir.dirents.insert(dirent_type(".", new_inode));
+   new_dir.dirents.insert(dirent_type("..",
+         parent == nullptr ? new_inode : parent));
+   return new_inode;
 }
 
-void directory::remove (const string& filename) {
-   DEBUGF ('i', filename);
+void directory::release (vector<inode_ptr>& subdirs) {
+   for (auto& entry: dirents) {
+      if (entry.first != "." && entry.first != ".." &&
+            entry.second->is_dir()) {
+         subdirs.push_back(move(entry.second));
+      }
+   }
+   if (shared_from != nullptr) {
+      shared_from->as_dir().forget_borrower(dirents.at("."));
+      shared_from = nullptr;
+   }
+   dirents.clear();
+   borrowers.clear();
 }
 
 inode_ptr directory::mkdir (const string& dirname, inode_ptr parent) {
    DEBUGF ('i', dirname);
 
-   inode_ptr new_inode = make_shared<inode>(file_type::DIRECTORY_TYPE);
-   directory_entries& new_inode_dirents = new_inode->get_dirents();
-   new_inode_dirents.insert(dirent_type(".", new_inode));
-   new_inode_dirents.insert(dirent_type("..", parent));
+   inode_ptr new_inode = new_dir_inode(parent);
+   new_inode->name_key = word_hash(dirname);
 
-   dirents.insert({dirname, new_inode});
+   get_dirents().insert({dirname, new_inode});
 
    return new_inode;
 }
@@ -304,42 +1649,32 @@ inode_ptr directory::mkdir (const string& dirname, inode_ptr parent) {
 inode_ptr directory::mkfile (const string& filename) {
    DEBUGF ('i', filename);
 
-   inode_ptr new_inode = make_shared<inode>(file_type::PLAIN_TYPE);
+   inode_ptr new_inode = make_shared<inode>(file_type::PLAIN_TYPE,
+         space->reserve_inode_nrs(1));
+   new_inode->name_key = word_hash(filename);
    
-   dirents.insert({filename, new_inode});
+   get_dirents().insert({filename, new_inode});
 
    return new_inode;
 }
 
+const directory_entries& directory::read_dirents() const {
+   return shared_from != nullptr ? shared_from->as_dir().dirents : dirents;
+}
+
 directory_entries& directory::get_dirents() {
+   if (shared_from != nullptr) {
+      materialize();
+   }
    return dirents;
 }
 
 bool directory::file_exists(const string& name) {
    // check if a file name exists under this directory
 
-   if (dirents.find(name) == dirents.end()) {  // does not exist
+   if (get_dirents().count(name) == 0) {  // does not exist
       return false;
    }
    return true;
 }
 
-void directory::bf_ls() {
-   // do the ls output for this dir as the target
-
-   map<string, inode_ptr>::iterator iter;
-   for (iter = dirents.begin(); iter != dirents.end(); ++iter) {
-      cout << std::setw(6);
-      cout << iter->second->get_inode_nr();
-      cout << "  ";
-      cout << std::setw(6);
-      cout << iter->second->size();
-      cout << "  ";
-      cout << iter->first;
-      if (iter->second->get_file_type().compare("directory") == 0) {
-         cout << "/";
-      }
-      cout << endl;
-   }
-}
-
@@ -4,13 +4,19 @@
 #define INODE_H
 
 #include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <map>
+#include <variant>
 #include <vector>
 using namespace std;
 
 #include "util.h"
+#include "watch.h"
+#include "word_index.h"
+#include "word_store.h"
 
 // command_error -
 //    Extend runtime_error for throwing exceptions related to this 
@@ -21,35 +27,237 @@ public:
    explicit command_error(const string& what);
 };
 
+// class fs_status -
+//    The outcome of a file system operation: ok, or the message to
+//    report.  Lookups of missing names and of the wrong file type
+//    return one of these instead of throwing, since some workloads
+//    probe for missing paths far more often than they find them.
+//    Command functions turn a failed status into a complaint.
+
+class fs_status {
+   private:
+      string message_;
+   public:
+      fs_status() = default;
+      explicit fs_status (const string& message): message_ (message) {}
+      bool ok() const { return message_.empty(); }
+      const string& message() const { return message_; }
+};
+
 // inode_t -
-//    An inode is either a directory or a plain file.
+//    An inode is either a directory or a plain file.  The inode holds
+//    its contents in place as a variant whose index is the file_type,
+//    so type tests are an integer compare and no call is virtual.
 
 enum class file_type {PLAIN_TYPE, DIRECTORY_TYPE};
 class inode;
-class base_file;
 class plain_file;
 class directory;
+class fs_namespace;
+struct host_entry;
 using inode_ptr = shared_ptr<inode>;
-using base_file_ptr = shared_ptr<base_file>;
 using directory_entries = map<string,inode_ptr>;
 using dirent_type = directory_entries::value_type;
 ostream& operator<< (ostream&, file_type);
 
-
+// struct populate_spec -
+//    The shape of a tree made by populate.  The top directory and
+//    every one below it, down to depth levels, hold files files, and
+//    every one above the last level holds fanout subdirectories.
+//    Each file gets from min_words to max_words words, drawn from
+//    seed and the file's place in the tree alone.  parallel builds
+//    the top directory's subtrees on several threads.
+
+struct populate_spec {
+   size_t fanout {0};
+   size_t depth {0};
+   size_t files {0};
+   size_t min_words {0};
+   size_t max_words {0};
+   uint64_t seed {0};
+   bool parallel {false};
+};
+
+
+// class fs_namespace -
+//    A tree of inodes with its own inode numbers, word index and
+//    watches: the whole tree from /, or one mounted on a directory of
+//    another by fs_mount.  The usage, hash, quota and watch walks up
+//    from a change stop at the root of its namespace, and a pending
+//    copy never shares entries across namespaces, so a change in one
+//    writes nothing in any other, and threads may change different
+//    namespaces at once with no lock between them.
+// reserve_inode_nrs -
+//    Takes count numbers in sequence and returns the first, for a tree
+//    numbered before it is built.
+
+class fs_namespace {
+   friend class inode_state;
+   private:
+      size_t next_inode_nr {1};
+      word_index word_idx;
+      watch_table watches;
+      weak_ptr<inode> root;       // its root directory
+      string mount_path;          // where it is mounted
+      uint64_t mount_hash {0};    // its mount point's hash in the
+                                  // directory above
+   public:
+      size_t reserve_inode_nrs (size_t count);
+};
+
+// class fs_version -
+//    A point-in-time image of the tree from /, pinned for as long as
+//    it is held (see inode_state::pin_version).  It is a pending copy
+//    of the root, so changes open it one level at a time ahead of
+//    themselves (see unshare_path) and it never sees them.  Its inodes
+//    are copies that keep the numbers they had when it was pinned, and
+//    take none from the namespace.  The image holds the root namespace
+//    only: a mount point in it is an empty directory.
+//    Dropping the last holder, on the thread that changes the tree,
+//    frees what the image had to copy.
+
+class fs_version {
+   private:
+      size_t nr;
+      inode_ptr root;
+   public:
+      fs_version (size_t nr_, inode_ptr root_): nr (nr_), root (root_) {}
+      fs_version (const fs_version&) = delete;
+      fs_version& operator= (const fs_version&) = delete;
+      ~fs_version();
+      size_t number() const { return nr; }
+      inode_ptr get_root() const { return root; }
+};
+
 // inode_state -
 //    A small convenient class to maintain the state of the simulated
-//    process:  the root (/), the current directory (.), and the
-//    prompt.
+//    process:  the root (/), the current directory (.), the
+//    prompt, and the optional word index over file contents.
+// Memory accounting -
+//    Every inode carries the bytes used by its whole subtree: node
+//    overhead, dirent keys, and word storage.  Each change charges
+//    the difference to the changed dir and every dir above it, and
+//    checks their quotas first, so neither needs a tree walk.
+//    A copy is charged its full size, as if it shared nothing.
+// Copy on write -
+//    cp shares file contents, and cp -r shares whole directories,
+//    copying them one level at a time only when they are first
+//    opened.  Before a directory changes, unshare_path makes any
+//    pending copy of it or of a directory above it take its own
+//    entries, so a change is never seen through a copy.  cp -r
+//    reserves a number for every inode of the source when it runs,
+//    and opening a copy numbers its entries in preorder from its own
+//    number, so the numbers never depend on when it is opened.  Reads
+//    (ls, cat, df, diff, export, the source of cp) go through a
+//    pending copy to its source without opening it, showing the
+//    numbers its entries will have (see read_entries).
+// Content hashes -
+//    Every inode carries a hash of its contents: a file's is the hash
+//    of its words, a directory's sums the product of each entry's
+//    name key and hash.  Each change folds the difference into the
+//    changed dir and every dir above it, as for memory accounting,
+//    so equal hashes let diff skip a whole subtree.
+// Watches -
+//    Each change notifies the watches on the changed dir and the
+//    recursive ones on every dir above it, by the same walk up.
+//    With no watches at all, notify costs one test.
+// Mounts -
+//    A namespace mounted on a directory is entered in it like a
+//    subdirectory whose .. is that directory, so lookups, cd and cd ..
+//    cross into and out of it as into any other.  The directory above
+//    counts a mount point only as its entry, with a hash of its own,
+//    and each walk up, from charge to notify, ends at the root of the
+//    namespace where it began.  cp copies a tree in one namespace or
+//    holding a mount point into another at once, since a pending copy
+//    may not share entries across namespaces.  Unmounting unlinks the
+//    namespace at once and frees its inodes on a thread of its own;
+//    no directory in it may be used after that.
+// watch -
+//    Starts a watch of dir (see watch.h) and returns its queue; the
+//    watch ends when the queue is dropped.
+// lookup -
+//    The inode path names in the cwd (or / for root), or nullptr,
+//    opening the cwd first if it is a pending copy; for an inode that
+//    may change.
+// peek -
+//    The same, without opening anything: in a pending cwd, its
+//    source's entry, which must only be read.
+// read_entries -
+//    Calls fn with the view of each entry of dir, in name order, .
+//    and .. included, without opening a pending copy: the inode to
+//    read and the number the entry shows, which for an entry of a
+//    pending copy is the one it will have once opened.  A mount point
+//    in a pending version reads as hollow: an empty directory, with
+//    its node only for its type, so nothing is made to stand for it.
+// read_dir -
+//    read_entries for a dir that is not itself in a pending copy,
+//    giving fn each entry's node, number and size.
+// fs_read -
+//    Prints count words of a file from word offset, or with from_end
+//    its last count words, in O(log chunks) to find the first word
+//    (see word_store::at) plus the words printed; cat prints them all.
+// write_file, make_dir, remove -
+//    make, mkdir and rm in any directory, not just the cwd, for the
+//    library API (see fs_api.h).  The fs_ functions are the text
+//    front end to these, and to readfile and read_entries for cat and
+//    ls.
+// pin_version -
+//    Pins an image of the tree as it is now, in O(1).  Writers go on
+//    as before, paying only for copy on write.
+// run_in -
+//    Runs fn with / and the cwd in version's image, at the cwd's path,
+//    then puts them back.  fn must not change the image.
+// fs_mount -
+//    Mounts a new namespace as path in the cwd: empty, or holding the
+//    tree of the host directory host, read as import reads it, which
+//    is how a tree is kept between runs.
 
 class inode_state {
    friend class inode;
    friend ostream& operator<< (ostream& out, const inode_state&);
    private:
+      struct entry_view {
+         inode_ptr node;     // to read only, if in a pending copy
+         size_t nr;          // the number it shows
+         bool renumbered;    // its entries are numbered from nr
+         bool hollow {false};  // a mount point a version holds empty
+         size_t size() const;
+      };
       inode_ptr root {nullptr};
       inode_ptr cwd {nullptr};
       string prompt_ {"% "};
 
       wordvec cwd_abs_path_str;  // keeps the path print str updated
+      shared_ptr<fs_namespace> root_space;
+      vector<shared_ptr<fs_namespace>> mounts;
+      size_t mounts_made {0};
+      size_t versions_made {0};
+      vector<future<void>> reapers;  // freeing unmounted namespaces
+      void check_quota(const string& cmd, inode_ptr dir, size_t growth);
+      void charge(inode_ptr dir, ptrdiff_t delta, ptrdiff_t inodes);
+      void recharge_file(inode_ptr dir, const string& name,
+            inode_ptr file);
+      void notify(fs_event_kind kind, inode_ptr dir, const string& name,
+            inode_ptr node);
+      inode_ptr file_for_write(const string& cmd, inode_ptr dir,
+            const string& fn, size_t data_bytes);
+      size_t word_pos(const string& cmd, const string& arg);
+      void import_entries(inode_ptr dir, host_entry& tree);
+      void index_tree(inode_ptr dir);
+      inode_ptr populate_dir(inode_ptr parent, const populate_spec& spec,
+            const vector<size_t>& subtree, size_t level,
+            size_t first_nr, size_t inode_nr);
+      void unshare_path(inode_ptr dir);
+      inode_ptr peek(const string& path);
+      void read_entries(const entry_view& dir, const entry_view& parent,
+            const function<void(const string&, const entry_view&)>& fn);
+      bool shares_across(inode_ptr source);
+      inode_ptr copy_tree(inode_ptr source, inode_ptr parent);
+      void rehash(inode_ptr dir, uint64_t key, uint64_t old_hash,
+            uint64_t new_hash);
+      void diff_dirs(inode_ptr left, inode_ptr right,
+            const string& left_path, const string& right_path,
+            ostream& out);
    public:
       inode_state (const inode_state&) = delete; // copy ctor
       inode_state& operator= (const inode_state&) = delete; // op=
@@ -59,101 +267,97 @@ class inode_state {
       const inode_ptr get_root() const { return root; }
 
       inode_ptr get_cwd();
+      const wordvec& cwd_path() const { return cwd_abs_path_str; }
+      inode_ptr lookup(const string& path);
+      inode_ptr resolve(const wordvec& path);
+      void read_dir(inode_ptr dir, const function<void(const string&,
+            const inode_ptr&, size_t, size_t)>& fn);
+      fs_status run_at(const wordvec& path,
+            const function<fs_status()>& fn);
+      shared_ptr<fs_version> pin_version();
+      fs_status run_in(const fs_version& version,
+            const function<fs_status()>& fn);
+      word_index& get_word_index() { return root_space->word_idx; }
 
-      void fs_ls(const string path);
-      void fs_pwd();
-      void fs_make(const wordvec& words);
-      void fs_mkdir(const string path);
-      void fs_cat(const string fn);
-      void fs_cd(const string path);
-};
-
-// class inode -
-// inode ctor -
-//    Create a new inode of the given type.
-// get_inode_nr -
-//    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
-// size -
-//    Returns the size of an inode.  For a directory, this is the
-//    number of dirents.  For a text file, the number of characters
-//    when printed (the sum of the lengths of each word, plus the
-//    number of words.
-//    
+      fs_status write_file(inode_ptr dir, const string& name,
+            wordvec&& data);
+      fs_status make_dir(inode_ptr dir, const string& name);
+      fs_status remove(inode_ptr dir, const string& name);
+      shared_ptr<event_queue> watch(inode_ptr dir, bool recursive,
+            size_t capacity);
 
-class inode {
-   friend class inode_state;
-   private:
-      static size_t next_inode_nr;
-      size_t inode_nr;
-      base_file_ptr contents;
-   public:
-      inode() = delete;
-      inode (const inode&) = delete;
-      inode& operator= (const inode&) = delete;
-      inode (file_type);
-      size_t get_inode_nr() const;
-      directory_entries& get_dirents();
-
-      const string& get_file_type();
-      size_t size();
+      fs_status fs_ls(const string path, ostream& out);
+      void fs_pwd(ostream& out);
+      fs_status fs_make(const wordvec& words);
+      fs_status fs_append(const wordvec& words);
+      fs_status fs_insert(const wordvec& words);
+      fs_status fs_delword(const wordvec& words);
+      fs_status fs_mkdir(const string path);
+      fs_status fs_cat(const string fn, ostream& out);
+      fs_status fs_read(const string& cmd, const string fn,
+            size_t offset, size_t count, bool from_end, ostream& out);
+      fs_status fs_cd(const string path);
+      fs_status fs_rm(const string path);
+      fs_status fs_cp(const string from, const string to,
+            bool recursive);
+      fs_status fs_import(const string host, const string path);
+      fs_status fs_populate(const string path, const populate_spec& spec);
+      fs_status fs_export(const string path, const string host);
+      fs_status fs_quota(const string path, size_t bytes);
+      fs_status fs_df(const string path, ostream& out);
+      fs_status fs_diff(const string left, const string right,
+            ostream& out);
+      fs_status fs_mount(const string path, const string host);
+      fs_status fs_umount(const string path);
+      void fs_mounts(ostream& out);
+      void fs_search(const wordvec& words, ostream& out);
 };
 
-
-// class base_file -
-// Just a base class at which an inode can point.  No data or
-// functions.  Makes the synthesized members useable only from
-// the derived classes.
-
 class file_error: public runtime_error {
    public:
       explicit file_error (const string& what);
 };
 
-class base_file {
-   friend class inode_state;
-   friend class inode;
-   protected:
-      base_file() = default;
-      virtual const string& file_type() const = 0;
-   public:
-      virtual ~base_file() = default;
-      base_file (const base_file&) = delete;
-      base_file& operator= (const base_file&) = delete;
-      virtual size_t size() const = 0;
-      virtual const wordvec& readfile() const;
-      virtual void writefile (const wordvec& newdata);
-      virtual void remove (const string& filename);
-      virtual inode_ptr mkdir (const string& dirname, 
-            inode_ptr parent);
-      virtual inode_ptr mkfile (const string& filename);
-      virtual directory_entries& get_dirents();
-
-      virtual bool file_exists(const string&);
-
-      virtual void bf_ls();
-};
-
 // class plain_file -
 // Used to hold data.
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
+//    Default word_store is empty.
+// share_from -
+//    Makes the file hold the same words as another without copying
+//    them.  The first edit to either one copies the words.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
+//    Returns the words of the file for a command that reads them,
+//    without copying them, reading them back from the spill file
+//    first if they were spilled (see content_tier::touch).
+// contents -
+//    The same, for the shell's own use of the words, which is not
+//    counted as a use of the file (see content_tier::page_in).
 // writefile -
 //    Replaces the contents of a file with new contents.
+// appendfile -
+//    Adds words to the end of the file without rewriting it.
+// insertwords -
+//    Inserts words before word position pos.
+// erasewords -
+//    Removes count words starting at pos and returns them.
+//    Positions past the end throw a file_error.
 
-class plain_file: public base_file {
+class plain_file {
    private:
-      wordvec data;
-      virtual const string& file_type() const override {
-         static const string result = "plain file";
-         return result;
-      }
+      shared_ptr<word_store> data {make_shared<word_store>()};
+      word_store& own();
    public:
-      virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
+      plain_file() = default;
+      plain_file (const plain_file&) = delete;
+      plain_file& operator= (const plain_file&) = delete;
+      size_t size() const;
+      void share_from (const plain_file& source);
+      const word_store& readfile();
+      const word_store& contents();
+      void writefile (wordvec newdata);
+      void appendfile (wordvec&& newdata);
+      void insertwords (size_t pos, wordvec&& newdata);
+      wordvec erasewords (size_t pos, size_t count);
 };
 
 // class directory -
@@ -162,7 +366,7 @@ class plain_file: public base_file {
 //    Creates a new map with keys "." and "..".
 // remove -
 //    Removes the file or subdirectory from the current inode.
-//    Throws a file_error if the file does not exist, 
+//    Returns a failed fs_status if the file does not exist, 
 //    or the subdirectory is not empty.
 //    Here empty means the only entries are dot (.) and dotdot (..).
 // mkdir -
@@ -173,27 +377,134 @@ class plain_file: public base_file {
 // mkfile -
 //    Create a new empty text file with the given name.  Error if
 //    a dirent with that name exists.
+// new_dir_inode -
+//    Create a directory inode holding just . and .. (parent), not yet
+//    entered in any directory, numbered next in parent's namespace,
+//    or as inode_nr in space.
+// parent -
+//    The .. inode, without opening a pending copy.
+// share_from -
+//    Makes a new directory a pending copy of source's entries.
+//    Nothing is copied until the directory is first opened, when
+//    its entries become copies of source's that are pending in turn.
+//    With keep_nrs, as in a version, the copies keep their source's
+//    inode numbers instead of taking new ones.
+// unshare -
+//    Opens every pending copy of this directory, before it changes.
+// read_dirents -
+//    The entries without opening a pending copy: for one, its
+//    source's, whose . and .. are the source's own.
+// get_space -
+//    The namespace the directory belongs to.
+// release -
+//    Drops every entry and pending copy, adding the subdirectories to
+//    subdirs, to free a tree whose . and .. would keep it alive.
 
-class directory: public base_file {
+class directory {
+   friend class inode_state;
    private:
       // Must be a map, not unordered_map, so printing is lexicographic
       directory_entries dirents;
-      virtual const string& file_type() const override {
-         static const string result = "directory";
-         return result;
-      }
+      shared_ptr<fs_namespace> space;
+      inode_ptr shared_from;               // pending copy of its entries
+      bool keep_nrs {false};               // its copies keep their numbers
+      vector<weak_ptr<inode>> borrowers;   // pending copies of ours
+      void materialize();
+      void forget_borrower (const inode_ptr& borrower);
    public:
-      virtual size_t size() const override;
-      virtual void remove (const string& filename) override;
-      virtual inode_ptr mkdir (const string& dirname, 
-            inode_ptr parent) override;
-      virtual inode_ptr mkfile (const string& filename) override;
-      virtual directory_entries& get_dirents() override;
+      directory() = default;
+      directory (const directory&) = delete;
+      directory& operator= (const directory&) = delete;
+      size_t size() const;
+      fs_status remove (const string& filename);
+      inode_ptr mkdir (const string& dirname, inode_ptr parent);
+      inode_ptr mkfile (const string& filename);
+      directory_entries& get_dirents();
+      const directory_entries& read_dirents() const;
+      static inode_ptr new_dir_inode (inode_ptr parent);
+      static inode_ptr new_dir_inode (inode_ptr parent,
+            shared_ptr<fs_namespace> space, size_t inode_nr);
+      inode_ptr parent() const { return dirents.at(".."); }
+      void share_from (inode_ptr source, bool keep_nrs_ = false);
+      void unshare();
+      void release (vector<inode_ptr>& subdirs);
+      const shared_ptr<fs_namespace>& get_space() const { return space; }
 
-      virtual bool file_exists(const string&) override;
+      bool file_exists(const string&);
+};
 
-      virtual void bf_ls() override;
+// class inode -
+// inode ctor -
+//    Create a new inode of the given type, numbered inode_nr, as taken
+//    from its namespace by fs_namespace::reserve_inode_nrs.
+// get_inode_nr -
+//    Retrieves the serial number of the inode.  Inode numbers are
+//    allocated in sequence by small integer, separately in each
+//    namespace.
+// type, is_dir -
+//    The tag of the contents.
+// as_file, as_dir -
+//    The contents as the given type.  Throws a file_error naming the
+//    actual type ("is a directory") if it is the other one.
+// try_file, try_dir -
+//    The same, but nullptr for the other type instead of throwing.
+// size -
+//    Returns the size of an inode.  For a directory, this is the
+//    number of dirents.  For a text file, the number of characters
+//    when printed (the sum of the lengths of each word, plus the
+//    number of words.
+// usage -
+//    Bytes held by this inode and everything below it.
+// quota, get_quota -
+//    Most bytes a directory may hold, or 0 for no limit.
+// hash -
+//    The content hash of this inode and everything below it.
+// name_key -
+//    The hash of this inode's name in its directory.
+// inodes -
+//    The number of inodes in this inode's subtree, itself included,
+//    in its namespace; a cp -r copy of it reserves that many numbers.
+//    
+
+class inode {
+   friend class inode_state;
+   friend class directory;
+   private:
+      size_t inode_nr;
+      variant<plain_file,directory> contents;
+      size_t usage {0};
+      size_t quota {0};
+      uint64_t hash {0};
+      uint64_t name_key {0};
+      size_t inodes {1};
+      [[noreturn]] void wrong_type() const;
+   public:
+      inode() = delete;
+      inode (const inode&) = delete;
+      inode& operator= (const inode&) = delete;
+      inode (file_type, size_t inode_nr_);
+      size_t get_inode_nr() const;
+      size_t get_quota() const { return quota; }
+      directory_entries& get_dirents() { return as_dir().get_dirents(); }
+
+      file_type type() const {
+         return static_cast<file_type> (contents.index());
+      }
+      bool is_dir() const {
+         return contents.index() == 
+                static_cast<size_t> (file_type::DIRECTORY_TYPE);
+      }
+      plain_file& as_file() {
+         if (is_dir()) wrong_type();
+         return *get_if<plain_file> (&contents);
+      }
+      directory& as_dir() {
+         if (not is_dir()) wrong_type();
+         return *get_if<directory> (&contents);
+      }
+      plain_file* try_file() { return get_if<plain_file> (&contents); }
+      directory* try_dir() { return get_if<directory> (&contents); }
+      size_t size() const;
 };
 
 #endif
-
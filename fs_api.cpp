@@ -0,0 +1,107 @@
+// $Id: fs_api.cpp,v 1.1 2022-02-14 11:02:37-08 - - $
+
+using namespace std;
+
+#include "debug.h"
+#include "fs_api.h"
+
+// The errors a shell command would complain about become the
+// status of the one item that raised them.
+
+template <typename operation>
+static fs_status item_status (operation run) {
+   try {
+      return run();
+   } catch (command_error& error) {
+      return fs_status (error.what());
+   } catch (file_error& error) {
+      return fs_status (error.what());
+   }
+}
+
+inode_ptr fs_api::open_dir (const string& path) {
+   wordvec components {"/"};
+   for (auto& name: split (path, "/")) components.push_back (move (name));
+   return state.resolve (components);
+}
+
+vector<inode_ptr> fs_api::lookup (inode_ptr dir, const wordvec& names) {
+   DEBUGF ('a', names.size() << " names");
+   const directory_entries& entries = dir->get_dirents();
+   vector<inode_ptr> found;
+   found.reserve (names.size());
+   for (const auto& name: names) {
+      auto entry = entries.find (name);
+      found.push_back (entry == entries.end() ? nullptr : entry->second);
+   }
+   return found;
+}
+
+vector<fs_status> fs_api::make_dirs (inode_ptr dir,
+                                     const wordvec& names) {
+   DEBUGF ('a', names.size() << " names");
+   vector<fs_status> statuses;
+   statuses.reserve (names.size());
+   for (const auto& name: names) {
+      statuses.push_back (item_status ([&] {
+         return state.make_dir (dir, name);
+      }));
+   }
+   return statuses;
+}
+
+vector<fs_status> fs_api::write (inode_ptr dir,
+                                 vector<fs_file>&& files) {
+   DEBUGF ('a', files.size() << " files");
+   vector<fs_status> statuses;
+   statuses.reserve (files.size());
+   for (auto& file: files) {
+      statuses.push_back (item_status ([&] {
+         return state.write_file (dir, file.name, move (file.words));
+      }));
+   }
+   return statuses;
+}
+
+vector<const word_store*> fs_api::read (inode_ptr dir,
+                                        const wordvec& names) {
+   DEBUGF ('a', names.size() << " names");
+   const directory_entries& entries = dir->as_dir().read_dirents();
+   vector<const word_store*> views;
+   views.reserve (names.size());
+   for (const auto& name: names) {
+      auto entry = entries.find (name);
+      plain_file* file = entry == entries.end() ? nullptr
+                                                : entry->second->try_file();
+      views.push_back (file == nullptr ? nullptr : &file->readfile());
+   }
+   return views;
+}
+
+vector<fs_entry> fs_api::list (inode_ptr dir) {
+   vector<fs_entry> listing;
+   listing.reserve (dir->size());
+   state.read_dir (dir, [&] (const string& name, const inode_ptr& node,
+                             size_t nr, size_t size) {
+      listing.push_back ({name, nr, node->type(), size});
+   });
+   return listing;
+}
+
+vector<fs_status> fs_api::remove (inode_ptr dir, const wordvec& names) {
+   DEBUGF ('a', names.size() << " names");
+   vector<fs_status> statuses;
+   statuses.reserve (names.size());
+   for (const auto& name: names) {
+      statuses.push_back (item_status ([&] {
+         return state.remove (dir, name);
+      }));
+   }
+   return statuses;
+}
+
+shared_ptr<event_queue> fs_api::watch (inode_ptr dir, bool recursive,
+                                       size_t capacity) {
+   return state.watch (dir, recursive, capacity);
+}
+
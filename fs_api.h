@@ -0,0 +1,88 @@
+// $Id: fs_api.h,v 1.1 2022-02-14 11:02:37-08 - - $
+
+#ifndef FS_API_H
+#define FS_API_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+#include "watch.h"
+#include "word_store.h"
+
+// fs_entry -
+//    One directory entry as returned by fs_api::list.  name views a
+//    key of the directory, or of the one it is a pending copy of, so
+//    it is valid until either changes.
+
+struct fs_entry {
+   string_view name;
+   size_t inode_nr;
+   file_type type;
+   size_t size;
+};
+
+// fs_file -
+//    A file for fs_api::write to create or replace, with its words.
+
+struct fs_file {
+   string name;
+   wordvec words;
+};
+
+// class fs_api -
+//    Typed access to an inode_state for programs linked with
+//    libyshell.a, with no command text to build and no output to
+//    parse.  Each batch works on many names in one directory and
+//    reports each outcome separately, so one bad name does not stop
+//    the rest.  With a memory budget, call content_tier::enforce
+//    between batches, as the shell does between lines.
+// open_dir -
+//    The directory at an absolute path like "/a/b", or nullptr if
+//    there is none.  The other calls need a directory from here.
+// lookup -
+//    The inode of each name, or nullptr where it is missing.  Since
+//    the caller may change them, a pending copy (see cp -r) is opened
+//    first; read and list go through one without opening it.
+// make_dirs -
+//    Makes a subdirectory for each name, as mkdir does.
+// write -
+//    Creates or replaces each file, as make does, moving its words in.
+// read -
+//    A view of the words of each file, or nullptr for a missing name
+//    or a directory.  A view is valid until the file changes or is
+//    spilled by content_tier::enforce.  Reading one writes nothing,
+//    so threads may share a view, seeking with at() in O(log chunks).
+// list -
+//    Every entry, . and .. included, in name order, numbered as ls
+//    shows them.
+// remove -
+//    Removes each file or empty subdirectory, as rm does.
+// watch -
+//    Starts a watch of dir, or with recursive of its whole subtree,
+//    whose events any thread may poll from the queue returned (see
+//    watch.h), in place of listing it again.  Dropping the queue ends
+//    the watch.
+
+class fs_api {
+   private:
+      inode_state& state;
+   public:
+      explicit fs_api (inode_state& state_): state (state_) {}
+      inode_ptr open_dir (const string& path);
+      vector<inode_ptr> lookup (inode_ptr dir, const wordvec& names);
+      vector<fs_status> make_dirs (inode_ptr dir, const wordvec& names);
+      vector<fs_status> write (inode_ptr dir, vector<fs_file>&& files);
+      vector<const word_store*> read (inode_ptr dir,
+                                      const wordvec& names);
+      vector<fs_entry> list (inode_ptr dir);
+      vector<fs_status> remove (inode_ptr dir, const wordvec& names);
+      shared_ptr<event_queue> watch (inode_ptr dir, bool recursive,
+                                     size_t capacity = 1024);
+};
+
+#endif
+
@@ -0,0 +1,172 @@
+// $Id: host_io.cpp,v 1.1 2022-02-09 13:37:02-08 - - $
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "file_sys.h"
+#include "host_io.h"
+
+void parallel_for (size_t count, const function<void(size_t)>& fn) {
+   size_t threads = min<size_t> (max (1u, thread::hardware_concurrency()),
+                                 16);
+   threads = min (threads, count);
+   atomic<size_t> next {0};
+   exception_ptr error;
+   mutex error_lock;
+   auto worker = [&] () {
+      for (;;) {
+         size_t nr = next.fetch_add (1);
+         if (nr >= count) return;
+         try {
+            fn (nr);
+         } catch (...) {
+            lock_guard<mutex> guard (error_lock);
+            if (not error) error = current_exception();
+            next = count;
+         }
+      }
+   };
+   vector<thread> pool;
+   for (size_t nr = 1; nr < threads; ++nr) pool.emplace_back (worker);
+   worker();
+   for (auto& pool_thread: pool) pool_thread.join();
+   if (error) rethrow_exception (error);
+}
+
+// read_words -
+//    Maps a host file and splits it into words.  Small and special
+//    files that cannot be mapped are read with large preads instead.
+
+static wordvec read_words (const string& cmd, const string& path) {
+   int fd = open (path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      throw command_error (cmd + ": " + path + ": " + strerror (errno));
+   }
+   struct stat info;
+   string text;
+   if (fstat (fd, &info) == 0 and info.st_size > 0) {
+      size_t length = static_cast<size_t> (info.st_size);
+      void* mapped = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+         madvise (mapped, length, MADV_SEQUENTIAL);
+         text.assign (static_cast<const char*> (mapped), length);
+         munmap (mapped, length);
+      } else {
+         text.resize (length);
+         size_t done = 0;
+         while (done < length) {
+            ssize_t got = pread (fd, text.data() + done, length - done,
+                                 static_cast<off_t> (done));
+            if (got <= 0) break;
+            done += static_cast<size_t> (got);
+         }
+         text.resize (done);
+      }
+   }
+   close (fd);
+   return split (text, " \t\n");
+}
+
+host_entry read_host_tree (const string& cmd, const string& path) {
+   namespace fs = filesystem;
+   error_code error;
+   if (not fs::is_directory (path, error)) {
+      throw command_error (cmd + ": " + path + ": not a directory");
+   }
+
+   // Walk the structure serially, remembering where each file's words
+   // go, then fill them all in parallel.
+   host_entry root {"", true, {}, {}};
+   vector<pair<string,wordvec*>> files;
+   auto failed = [&] (const fs::path& failed_path) {
+      return command_error (cmd + ": " + failed_path.string() + ": "
+                            + error.message());
+   };
+   function<void(const fs::path&, host_entry&)> walk =
+         [&] (const fs::path& dir_path, host_entry& dir) {
+      fs::directory_iterator item (dir_path, error);
+      if (error) throw failed (dir_path);
+      for (; item != fs::directory_iterator(); item.increment (error)) {
+         if (error) throw failed (dir_path);
+         host_entry entry {item->path().filename().string(),
+                           false, {}, {}};
+         // Links to directories are not followed, since one pointing
+         // above itself would import the tree into itself.
+         fs::file_status status = item->symlink_status (error);
+         if (error) throw failed (item->path());
+         if (fs::is_symlink (status)) {
+            status = item->status (error);
+            if (error or fs::is_directory (status)) continue;
+         }
+         if (fs::is_directory (status)) {
+            entry.is_dir = true;
+         } else if (not fs::is_regular_file (status)) {
+            continue;  // sockets, fifos, devices
+         }
+         dir.entries.push_back (move (entry));
+      }
+      if (error) throw failed (dir_path);
+      sort (dir.entries.begin(), dir.entries.end(),
+            [] (const host_entry& a, const host_entry& b) {
+               return a.name < b.name;
+            });
+      for (auto& entry: dir.entries) {
+         fs::path entry_path = dir_path / entry.name;
+         if (entry.is_dir) walk (entry_path, entry);
+                      else files.emplace_back (entry_path, &entry.words);
+      }
+   };
+   walk (path, root);
+   DEBUGF ('h', path << ": " << files.size() << " files");
+
+   parallel_for (files.size(), [&] (size_t nr) {
+      *files[nr].second = read_words (cmd, files[nr].first);
+   });
+   return root;
+}
+
+void write_host_files (const string& cmd,
+                       const vector<host_file>& files) {
+   DEBUGF ('h', files.size() << " files");
+   parallel_for (files.size(), [&] (size_t nr) {
+      const host_file& file = files[nr];
+      string text;
+      text.reserve (file.words->chars() + file.words->size() + 1);
+      for (const auto& word: *file.words) {
+         if (not text.empty()) text.push_back (' ');
+         text.append (word);
+      }
+      text.push_back ('\n');
+      int fd = open (file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                     0666);
+      if (fd < 0) {
+         throw command_error (cmd + ": " + file.path + ": "
+                              + strerror (errno));
+      }
+      size_t done = 0;
+      while (done < text.size()) {
+         ssize_t put = write (fd, text.data() + done, text.size() - done);
+         if (put <= 0) break;
+         done += static_cast<size_t> (put);
+      }
+      close (fd);
+      if (done < text.size()) {
+         throw command_error (cmd + ": " + file.path + ": write failed");
+      }
+   });
+}
+
@@ -0,0 +1,60 @@
+// $Id: host_io.h,v 1.1 2022-02-09 13:37:02-08 - - $
+
+#ifndef HOST_IO_H
+#define HOST_IO_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "util.h"
+#include "word_store.h"
+
+// struct host_entry -
+//    One file or directory read from the host.  Entries of a directory
+//    are sorted by name, so they can be inserted into a map with an
+//    end() hint.
+
+struct host_entry {
+   string name;
+   bool is_dir {false};
+   wordvec words;                    // plain files only
+   vector<host_entry> entries;       // directories only
+};
+
+// read_host_tree -
+//    Reads the host directory path and everything below it.  The tree
+//    is walked first; then the file contents are mapped and split
+//    into words (as split() does, on blanks, tabs and newlines) by
+//    several threads at once.  Links to files are read, links to
+//    directories and dangling links are skipped.  Throws a
+//    command_error naming cmd if path, or any directory or file
+//    below it, can not be read.
+
+host_entry read_host_tree (const string& cmd, const string& path);
+
+// struct host_file -
+//    A file to be written by write_host_files.
+
+struct host_file {
+   string path;
+   const word_store* words;
+};
+
+// write_host_files -
+//    Creates each file and writes its words, separated by spaces and
+//    ending with a newline, with one write per file, using several
+//    threads at once.  Throws a command_error naming cmd on failure.
+
+void write_host_files (const string& cmd, const vector<host_file>& files);
+
+// parallel_for -
+//    Calls fn(0) .. fn(count - 1) from a few threads, each taking the
+//    next index as it finishes one.  The first exception is rethrown.
+
+void parallel_for (size_t count, const function<void(size_t)>& fn);
+
+#endif
+
@@ -1,29 +1,85 @@
 // $Id: main.cpp,v 1.13 2022-01-26 13:23:48-08 - - $
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <utility>
 #include <unistd.h>
 using namespace std;
 
+#include "bytecode.h"
 #include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
+#include "pipeline.h"
+#include "replica.h"
+#include "tiering.h"
+#include "trace.h"
 #include "util.h"
 
+// ysh_options -
+//    Settings gathered from the command line before the shell starts.
+
+struct ysh_options {
+   bool word_index {false};
+   string compile_to;   // -c: write bytecode for cin here and stop
+   string replay_from;  // -r: run this bytecode instead of cin
+   string primary_on;   // -P: ship changes to followers on this socket
+   string follow;       // -F: replicate from the primary on this socket
+   string trace_to;     // -t: record a trace of every line here
+   size_t memory {0};   // -m: bytes of file words to keep resident
+};
+
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis:  -@flags sets debug flags, -i enables the
+//    word index used by the search command, -c file compiles the
+//    script on cin to bytecode, and -r file replays such bytecode.
+//    -P socket runs as a replication primary listening on the Unix
+//    socket, and -F socket as a read-only follower of one.  -m bytes
+//    keeps at most that many bytes of file words in memory, spilling
+//    the rest to a temporary file.  -t file records when each line
+//    ran and how long it took, for ysh_replay.
 
-void scan_options (int argc, char** argv) {
+ysh_options scan_options (int argc, char** argv) {
+   ysh_options options;
    opterr = 0;
    for (;;) {
-      int option {getopt (argc, argv, "@:")};
+      int option {getopt (argc, argv, "@:F:P:c:im:r:t:")};
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'F':
+            options.follow = optarg;
+            break;
+         case 'P':
+            options.primary_on = optarg;
+            break;
+         case 'c':
+            options.compile_to = optarg;
+            break;
+         case 'i':
+            options.word_index = true;
+            break;
+         case 'm':
+            try {
+               options.memory = stoul (optarg);
+            } catch (exception&) {
+               complain() << "-m " << optarg << ": not a byte count"
+                          << endl;
+            }
+            break;
+         case 'r':
+            options.replay_from = optarg;
+            break;
+         case 't':
+            options.trace_to = optarg;
+            break;
          default:
             complain() << "-" << static_cast<char> (option)
                        << ": invalid option" << endl;
@@ -33,42 +89,50 @@ void scan_options (int argc, char** argv) {
    if (optind < argc) {
       complain() << "operands not permitted" << endl;
    }
+   return options;
 }
 
 
-// main -
-//    Main program which loops reading commands until end of file.
+// command_loop -
+//    Prints the prompt, fetches a line with next_line (empty at EOF),
+//    echoes it if needed, and runs it with run_line, until EOF or
+//    exit.  Errors from a line, thrown or returned as a failed
+//    fs_status, are reported and the loop goes on.  With a trace,
+//    each line is timed into it.
 
-int main (int argc, char** argv) {
-   exec::execname (argv[0]);
-   cout << boolalpha;  // Print false or true instead of 0 or 1.
-   cerr << boolalpha;
-   cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
-   scan_options (argc, argv);
-   bool need_echo {want_echo()};
-   inode_state state;
+const string& echo_text (const string& line) { return line; }
+const string& echo_text (const bytecode_program::line& line) {
+   return line.echo;
+}
+
+template <typename next_line_fn, typename run_line_fn>
+void command_loop (inode_state& state, bool need_echo,
+                   trace_writer* trace,
+                   next_line_fn next_line, run_line_fn run_line) {
    try {
       for (;;) {
          try {
             // Read a line, break at EOF, and echo print the prompt
             // if one is needed.
             cout << state.prompt();
-            string line;
-            getline (cin, line);
-            if (cin.eof()) {
+            auto line = next_line();
+            if (not line) {
                if (need_echo) cout << "^D";
                cout << endl;
                DEBUGF ('y', "EOF");
                break;
             }
-            if (need_echo) cout << line << endl;
-   
-            // Split the line into words and lookup the appropriate
-            // function.  Complain or call it.
-            wordvec words = split (line, " \t");
-            DEBUGF ('y', "words = " << words);
-            command_fn fn = find_command_fn (words.at(0));
-            fn (state, words);
+            if (need_echo) cout << echo_text (*line) << endl;
+            trace_line traced (trace, echo_text (*line));
+            fs_status status;
+            try {
+               status = run_line (*line);
+            } catch (ysh_exit&) {
+               traced.done (true);
+               throw;
+            }
+            traced.done (status.ok());
+            if (not status.ok()) complain() << status.message() << endl;
          }catch (file_error& error) {
             complain() << error.what() << endl;
          }catch (command_error& error) {
@@ -78,7 +142,134 @@ int main (int argc, char** argv) {
    } catch (ysh_exit&) {
       // This catch intentionally left blank.
    }
+}
+
+// main -
+//    Main program which loops reading commands until end of file,
+//    or compiles them, or replays compiled ones.
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   cout << boolalpha;  // Print false or true instead of 0 or 1.
+   cerr << boolalpha;
+   cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
+   ysh_options options {scan_options (argc, argv)};
+   bool need_echo {want_echo()};
+   inode_state state;
+   state.get_word_index().enable (options.word_index);
+
+   if (not options.compile_to.empty()) {
+      ofstream out (options.compile_to, ios::binary);
+      if (out) compile_script (cin, out);
+      if (not out) complain() << options.compile_to << ": write failed"
+                              << endl;
+      return exit_status_message();
+   }
+
+   unique_ptr<log_primary> primary;
+   unique_ptr<log_follower> follower;
+   unique_ptr<trace_writer> trace;
+   try {
+      if (options.memory > 0) content_tier::budget (options.memory);
+      if (not options.trace_to.empty()) {
+         trace = make_unique<trace_writer> (options.trace_to,
+                                            options.word_index,
+                                            options.memory);
+      }
+      if (not options.primary_on.empty() and not options.follow.empty()) {
+         throw command_error ("-P and -F are exclusive");
+      }
+      if (not options.primary_on.empty()) {
+         primary = make_unique<log_primary> (options.primary_on, state);
+      }
+      if (not options.follow.empty()) {
+         follower = make_unique<log_follower> (options.follow, state);
+      }
+   } catch (command_error& error) {
+      complain() << error.what() << endl;
+      return exit_status_message();
+   }
+
+   // A follower runs each line under its lock and refuses changes.
+   // A primary runs each line under its own lock, so the snapshot a
+   // late follower gets is taken between lines, and ships the changes
+   // of every stage that succeeded, even if another stage failed.
+   // Cold file words are spilled after each line, between commands.
+   auto replicated = [&] (const vector<wordvec>& stages, auto run) {
+      if (follower) {
+         for (const auto& stage: stages) {
+            if (not stage.empty() and changes_tree (stage.at(0))) {
+               throw command_error (stage.at(0)
+                                    + ": read-only follower");
+            }
+         }
+         lock_guard<mutex> guard (follower->state_lock);
+         fs_status status = run (nullptr);
+         content_tier::enforce();
+         return status;
+      }
+      unique_lock<mutex> guard;
+      if (primary) guard = unique_lock<mutex> (primary->state_lock);
+      wordvec path {state.cwd_path()};
+      vector<bool> succeeded (stages.size());
+      auto ship = [&] () {
+         if (primary) primary->record_line (path, stages, succeeded);
+         content_tier::enforce();
+      };
+      fs_status status;
+      try {
+         status = run (&succeeded);
+      } catch (...) {
+         ship();
+         throw;
+      }
+      ship();
+      return status;
+   };
+
+   if (not options.replay_from.empty()) {
+      bytecode_program program;
+      try {
+         ifstream in (options.replay_from, ios::binary);
+         if (not in) throw runtime_error ("cannot open");
+         program.load (in);
+      } catch (exception& error) {
+         complain() << options.replay_from << ": " << error.what()
+                    << endl;
+         return exit_status_message();
+      }
+      auto next = program.lines().begin();
+      command_loop (state, need_echo, trace.get(),
+         [&] () -> const bytecode_program::line* {
+            if (next == program.lines().end()) return nullptr;
+            return &*next++;
+         },
+         [&] (const bytecode_program::line& line) {
+            return replicated (line.stages,
+                               [&] (vector<bool>* succeeded) {
+               return run_compiled_line (state, line, succeeded);
+            });
+         });
+      return exit_status_message();
+   }
+
+   command_loop (state, need_echo, trace.get(),
+      [] () -> optional<string> {
+         string line;
+         getline (cin, line);
+         if (cin.eof()) return nullopt;
+         return line;
+      },
+      [&] (const string& line) {
+         // Split the line into words and lookup the appropriate
+         // function for each stage.  Complain or call them.
+         wordvec words = split (line, " \t");
+         DEBUGF ('y', "words = " << words);
+         vector<wordvec> stages = split_pipeline (words);
+         return replicated (stages, [&] (vector<bool>* succeeded) {
+            return run_pipeline (state, stages, succeeded);
+         });
+      });
 
    return exit_status_message();
 }
-
@@ -0,0 +1,232 @@
+// $Id: pipeline.cpp,v 1.1 2022-02-07 10:21:54-08 - - $
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+#include "debug.h"
+#include "pipeline.h"
+
+// Both ends sleep on events, which is bumped after every push, pop,
+// and close, so a waiter always rechecks after the other side moves.
+// Reading events before checking the condition avoids lost wakeups.
+
+static void signal_events (atomic<unsigned>& events) {
+   events.fetch_add (1, memory_order_release);
+   events.notify_all();
+}
+
+bool line_ring::push (string&& line) {
+   size_t pos = tail.load (memory_order_relaxed);
+   for (;;) {
+      unsigned seen = events.load (memory_order_acquire);
+      if (reader_done.load (memory_order_acquire)) return false;
+      if (pos - head.load (memory_order_acquire) < CAPACITY) break;
+      events.wait (seen, memory_order_acquire);
+   }
+   slots[pos & (CAPACITY - 1)] = move (line);
+   tail.store (pos + 1, memory_order_release);
+   signal_events (events);
+   return true;
+}
+
+bool line_ring::pop (string& line) {
+   size_t pos = head.load (memory_order_relaxed);
+   for (;;) {
+      unsigned seen = events.load (memory_order_acquire);
+      if (tail.load (memory_order_acquire) != pos) break;
+      if (writer_done.load (memory_order_acquire)) {
+         if (tail.load (memory_order_acquire) != pos) break;
+         return false;
+      }
+      events.wait (seen, memory_order_acquire);
+   }
+   line = move (slots[pos & (CAPACITY - 1)]);
+   head.store (pos + 1, memory_order_release);
+   signal_events (events);
+   return true;
+}
+
+void line_ring::close_write() {
+   writer_done.store (true, memory_order_release);
+   signal_events (events);
+}
+
+void line_ring::close_read() {
+   reader_done.store (true, memory_order_release);
+   signal_events (events);
+}
+
+
+ring_outbuf::int_type ring_outbuf::overflow (int_type ch) {
+   if (traits_type::eq_int_type (ch, traits_type::eof())) {
+      return traits_type::not_eof (ch);
+   }
+   line.push_back (traits_type::to_char_type (ch));
+   if (line.back() == '\n') {
+      ring.push (move (line));
+      line.clear();
+   }
+   return ch;
+}
+
+streamsize ring_outbuf::xsputn (const char* text, streamsize count) {
+   const char* end = text + count;
+   while (text != end) {
+      const char* newline = find (text, end, '\n');
+      if (newline == end) {
+         line.append (text, end);
+         break;
+      }
+      line.append (text, newline + 1);
+      ring.push (move (line));
+      line.clear();
+      text = newline + 1;
+   }
+   return count;
+}
+
+void ring_outbuf::close() {
+   if (not line.empty()) ring.push (move (line));
+   line.clear();
+   ring.close_write();
+}
+
+
+ring_inbuf::int_type ring_inbuf::underflow() {
+   if (gptr() < egptr()) return traits_type::to_int_type (*gptr());
+   if (not ring.pop (line)) return traits_type::eof();
+   setg (line.data(), line.data(), line.data() + line.size());
+   return traits_type::to_int_type (*gptr());
+}
+
+
+vector<wordvec> split_pipeline (const wordvec& words) {
+   vector<wordvec> stages (1);
+   for (const auto& word: words) {
+      if (word == "|") {
+         if (stages.back().empty()) {
+            throw command_error ("|: missing command");
+         }
+         stages.emplace_back();
+      } else {
+         stages.back().push_back (word);
+      }
+   }
+   if (stages.size() > 1 and stages.back().empty()) {
+      throw command_error ("|: missing command");
+   }
+   DEBUGF ('p', stages.size() << " stage(s)");
+   return stages;
+}
+
+fs_status run_pipeline (inode_state& state,
+                        const vector<wordvec>& stages,
+                        vector<bool>* succeeded) {
+   // Look every command up first, so a typo runs nothing.
+   vector<command_fn> fns;
+   for (const auto& stage: stages) {
+      fns.push_back (find_command_fn (stage.at(0)));
+   }
+   return run_stages (state, stages, fns, succeeded);
+}
+
+fs_status run_stages (inode_state& state, const vector<wordvec>& stages,
+                      const vector<command_fn>& fns,
+                      vector<bool>* succeeded) {
+   if (succeeded != nullptr) succeeded->assign (stages.size(), false);
+   if (stages.size() == 1) {
+      istringstream no_input;
+      command_io io {no_input, cout};
+      fs_status status = fns.front() (state, stages.front(), io);
+      if (succeeded != nullptr) succeeded->front() = status.ok();
+      return status;
+   }
+
+   // at swaps / and the cwd while it runs
+   for (const auto& stage: stages) {
+      if (stage.at(0) == "at") {
+         throw command_error ("at: not in a pipeline");
+      }
+   }
+
+   size_t count = stages.size();
+   vector<unique_ptr<line_ring>> rings;
+   vector<unique_ptr<ring_outbuf>> outbufs;
+   vector<unique_ptr<ring_inbuf>> inbufs;
+   for (size_t nr = 0; nr + 1 < count; ++nr) {
+      rings.push_back (make_unique<line_ring>());
+      outbufs.push_back (make_unique<ring_outbuf> (*rings.back()));
+      inbufs.push_back (make_unique<ring_inbuf> (*rings.back()));
+   }
+   vector<exception_ptr> errors (count);
+   vector<fs_status> statuses (count);
+
+   // Filters touch only their streams, so they run concurrently.  The
+   // other stages use the inode_state, and take turns in pipeline
+   // order.  None of those reads its input, which is dropped from the
+   // start, so a stage holding the turn never waits on one waiting
+   // for it.
+   vector<bool> filter (count);
+   for (size_t nr = 0; nr < count; ++nr) {
+      filter[nr] = is_filter (stages[nr]);
+   }
+   auto next_turn = [&] (size_t nr) {
+      while (nr < count and filter[nr]) ++nr;
+      return nr;
+   };
+   mutex turn_lock;
+   condition_variable turn_moved;
+   size_t turn = next_turn (0);
+
+   auto run_stage = [&] (size_t nr) {
+      if (not filter[nr]) {
+         if (nr > 0) rings[nr - 1]->close_read();
+         unique_lock<mutex> guard (turn_lock);
+         turn_moved.wait (guard, [&] { return turn == nr; });
+      }
+      istringstream no_input;
+      istream in_ring {nr == 0 ? nullptr : inbufs[nr - 1].get()};
+      ostream out_ring {nr + 1 == count ? nullptr : outbufs[nr].get()};
+      out_ring << boolalpha;
+      command_io io {nr == 0 ? static_cast<istream&> (no_input)
+                             : in_ring,
+                     nr + 1 == count ? cout : out_ring};
+      try {
+         statuses[nr] = fns[nr] (state, stages[nr], io);
+      } catch (...) {
+         errors[nr] = current_exception();
+      }
+      if (not filter[nr]) {
+         lock_guard<mutex> guard (turn_lock);
+         turn = next_turn (nr + 1);
+         turn_moved.notify_all();
+      }
+      if (nr + 1 < count) outbufs[nr]->close();
+      if (nr > 0) rings[nr - 1]->close_read();
+   };
+
+   vector<thread> threads;
+   for (size_t nr = 0; nr + 1 < count; ++nr) {
+      threads.emplace_back (run_stage, nr);
+   }
+   run_stage (count - 1);
+   for (auto& stage_thread: threads) stage_thread.join();
+
+   if (succeeded != nullptr) {
+      for (size_t nr = 0; nr < count; ++nr) {
+         (*succeeded)[nr] = not errors[nr] and statuses[nr].ok();
+      }
+   }
+   for (size_t nr = 0; nr < count; ++nr) {
+      if (errors[nr]) rethrow_exception (errors[nr]);
+      if (not statuses[nr].ok()) return statuses[nr];
+   }
+   return {};
+}
+
@@ -0,0 +1,104 @@
+// $Id: pipeline.h,v 1.1 2022-02-07 10:21:54-08 - - $
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "commands.h"
+#include "file_sys.h"
+#include "util.h"
+
+// class line_ring -
+//    Bounded single-producer single-consumer ring of lines connecting
+//    two pipeline stages.  push blocks while the ring is full and pop
+//    blocks while it is empty, so no stage ever holds more than the
+//    ring's capacity of another stage's output.
+// close_write -
+//    The producer is done; pop returns false once the ring drains.
+// close_read -
+//    The consumer is done (e.g. head has its lines); further pushes
+//    are discarded instead of blocking forever.
+
+class line_ring {
+   private:
+      static constexpr size_t CAPACITY {1024};  // power of two
+      vector<string> slots;
+      atomic<size_t> head {0};   // next slot to pop, consumer only
+      atomic<size_t> tail {0};   // next slot to push, producer only
+      atomic<bool> writer_done {false};
+      atomic<bool> reader_done {false};
+      atomic<unsigned> events {0};  // bumped on every state change
+   public:
+      line_ring(): slots (CAPACITY) {}
+      line_ring (const line_ring&) = delete;
+      line_ring& operator= (const line_ring&) = delete;
+      bool push (string&& line);
+      bool pop (string& line);
+      void close_write();
+      void close_read();
+};
+
+// class ring_outbuf -
+//    Output streambuf that cuts what is written into lines and
+//    pushes each complete line (with its newline) into a ring.
+
+class ring_outbuf: public streambuf {
+   private:
+      line_ring& ring;
+      string line;
+   protected:
+      virtual int_type overflow (int_type ch) override;
+      virtual streamsize xsputn (const char* text,
+                                 streamsize count) override;
+   public:
+      explicit ring_outbuf (line_ring& ring_): ring (ring_) {}
+      void close();
+};
+
+// class ring_inbuf -
+//    Input streambuf that reads lines popped from a ring.
+
+class ring_inbuf: public streambuf {
+   private:
+      line_ring& ring;
+      string line;
+   protected:
+      virtual int_type underflow() override;
+   public:
+      explicit ring_inbuf (line_ring& ring_): ring (ring_) {}
+};
+
+// split_pipeline -
+//    Splits the words of a command line into stages at each "|" word.
+//    A line without "|" is a single stage, exactly as before.
+// run_pipeline -
+//    Runs each stage, all concurrently when there is more than one,
+//    with stage i's output streamed into stage i+1's input.  The last
+//    stage writes to cout.  After all stages finish, the first error
+//    any stage raised is rethrown or returned.  Only filters (see
+//    is_filter) run alongside other stages; the stages that use the
+//    inode_state run one at a time, in order, and their input is
+//    discarded, since none of them reads it.  at may only run on a
+//    line of its own.  If succeeded is given, each of its elements is
+//    set to whether that stage ran to an ok status, even when the
+//    line as a whole fails.
+// run_stages -
+//    run_pipeline for stages whose commands are already looked up.
+
+vector<wordvec> split_pipeline (const wordvec& words);
+fs_status run_pipeline (inode_state& state,
+                        const vector<wordvec>& stages,
+                        vector<bool>* succeeded = nullptr);
+fs_status run_stages (inode_state& state, const vector<wordvec>& stages,
+                      const vector<command_fn>& fns,
+                      vector<bool>* succeeded = nullptr);
+
+#endif
+
@@ -0,0 +1,446 @@
+// $Id: replica.cpp,v 1.1 2022-02-12 10:05:41-08 - - $
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "replica.h"
+#include "tiering.h"
+
+static log_primary* running_primary {nullptr};
+static log_follower* running_follower {nullptr};
+
+static int64_t now_ns() {
+   return chrono::duration_cast<chrono::nanoseconds> (
+          chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void put_varint (string& out, size_t value) {
+   while (value >= 0x80) {
+      out.push_back (static_cast<char> ((value & 0x7F) | 0x80));
+      value >>= 7;
+   }
+   out.push_back (static_cast<char> (value));
+}
+
+static void put_words (string& out, const wordvec& words) {
+   put_varint (out, words.size());
+   for (const auto& word: words) {
+      put_varint (out, word.size());
+      out.append (word);
+   }
+}
+
+// class record_reader -
+//    Takes records back apart from a batch payload.
+
+class record_reader {
+   private:
+      const string& payload;
+      size_t pos {0};
+      size_t get_varint() {
+         size_t value {0};
+         for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= payload.size()) break;
+            unsigned char byte = static_cast<unsigned char> (payload[pos++]);
+            value |= static_cast<size_t> (byte & 0x7F) << shift;
+            if (not (byte & 0x80)) return value;
+         }
+         throw runtime_error ("bad replication record");
+      }
+   public:
+      explicit record_reader (const string& payload_):
+                              payload (payload_) {}
+      bool done() const { return pos >= payload.size(); }
+      wordvec get_words() {
+         wordvec words (get_varint());
+         for (auto& word: words) {
+            size_t length = get_varint();
+            if (length > payload.size() - pos) {
+               throw runtime_error ("bad replication record");
+            }
+            word.assign (payload, pos, length);
+            pos += length;
+         }
+         return words;
+      }
+};
+
+static sockaddr_un socket_address (const string& path) {
+   sockaddr_un address {};
+   address.sun_family = AF_UNIX;
+   if (path.size() >= sizeof address.sun_path) {
+      throw command_error (path + ": socket path too long");
+   }
+   strcpy (address.sun_path, path.c_str());
+   return address;
+}
+
+static bool send_all (int fd, const void* data, size_t length) {
+   const char* bytes = static_cast<const char*> (data);
+   while (length > 0) {
+      ssize_t sent = send (fd, bytes, length, MSG_NOSIGNAL);
+      if (sent < 0 and errno == EINTR) continue;
+      if (sent <= 0) return false;
+      bytes += sent;
+      length -= static_cast<size_t> (sent);
+   }
+   return true;
+}
+
+static bool recv_all (int fd, void* data, size_t length) {
+   char* bytes = static_cast<char*> (data);
+   while (length > 0) {
+      ssize_t got = recv (fd, bytes, length, 0);
+      if (got < 0 and errno == EINTR) continue;
+      if (got <= 0) return false;
+      bytes += got;
+      length -= static_cast<size_t> (got);
+   }
+   return true;
+}
+
+log_primary::log_primary (const string& path, inode_state& state_):
+               socket_path (path), state (state_) {
+   sockaddr_un address {socket_address (path)};
+   listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+   unlink (path.c_str());
+   if (listen_fd < 0
+    or bind (listen_fd, reinterpret_cast<sockaddr*> (&address),
+             sizeof address) < 0
+    or listen (listen_fd, 16) < 0) {
+      string error {strerror (errno)};
+      if (listen_fd >= 0) close (listen_fd);
+      throw command_error (path + ": " + error);
+   }
+   acceptor = thread (&log_primary::accept_loop, this);
+   batcher = thread (&log_primary::batch_loop, this);
+   running_primary = this;
+   DEBUGF ('r', "primary on " << path);
+}
+
+log_primary::~log_primary() {
+   running_primary = nullptr;
+   {
+      lock_guard<mutex> guard (lock);
+      closing = true;
+   }
+   changed.notify_all();
+   shutdown (listen_fd, SHUT_RDWR);
+   acceptor.join();
+   batcher.join();
+   for (auto& sender: senders) sender.join();
+   close (listen_fd);
+   unlink (socket_path.c_str());
+}
+
+void log_primary::accept_loop() {
+   for (;;) {
+      int fd = accept (listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+         if (errno == EINTR) continue;
+         return;  // shut down
+      }
+
+      // Between lines, cut what is pending, so the follower starts at
+      // the next batch.  If none was dropped yet, it replays them all
+      // instead of a snapshot.
+      lock_guard<mutex> tree_guard (state_lock);
+      unique_lock<mutex> guard (lock);
+      if (closing) {
+         close (fd);
+         return;
+      }
+      cut_batch();
+      size_t next = first_batch + batches.size();
+      if (first_batch == 0) next = 0;
+      cursors.insert (next);
+      ++followers;
+      uint64_t snapshot_seq {logged};
+      guard.unlock();
+
+      shared_ptr<batch> snapshot;
+      if (next > 0) {
+         snapshot = make_shared<batch>();
+         wordvec path {"/"};
+         const inode_ptr& root = state.get_root();
+         for (const auto& entry: root->as_dir().read_dirents()) {
+            if (entry.first == "." or entry.first == "..") continue;
+            record_tree (snapshot->payload, path, entry.first,
+                         entry.second);
+         }
+         if (root->get_quota() > 0) {
+            put_words (snapshot->payload, path);
+            put_words (snapshot->payload,
+                       {"quota", "/", to_string (root->get_quota())});
+         }
+         snapshot->header = {snapshot_seq, snapshot_seq, now_ns(),
+                             snapshot->payload.size()};
+      }
+      guard.lock();
+      senders.emplace_back (&log_primary::send_loop, this, fd, next,
+                            move (snapshot));
+      DEBUGF ('r', "follower " << followers << " connected at batch "
+                   << next);
+   }
+}
+
+void log_primary::cut_batch() {
+   // Called with lock held.
+   if (pending.empty()) return;
+   auto cut = make_shared<batch>();
+   cut->header = {logged, logged, now_ns(), pending.size()};
+   cut->payload.swap (pending);
+   shipped = logged;
+   batches.push_back (move (cut));
+   trim_batches();
+   changed.notify_all();
+}
+
+void log_primary::trim_batches() {
+   // Called with lock held.  Drops the batches every follower has
+   // been sent, which with no followers is all of them.
+   size_t keep = cursors.empty() ? first_batch + batches.size()
+                                 : *cursors.begin();
+   while (first_batch < keep) {
+      batches.pop_front();
+      ++first_batch;
+   }
+}
+
+void log_primary::batch_loop() {
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      changed.wait_for (guard, FLUSH_INTERVAL, [this] {
+         return closing or pending.size() >= BATCH_BYTES;
+      });
+      cut_batch();
+      if (closing) return;
+   }
+}
+
+void log_primary::send_loop (int fd, size_t next,
+                             shared_ptr<const batch> first) {
+   bool sent {true};
+   if (first != nullptr) {
+      sent = send_all (fd, &first->header, sizeof first->header)
+         and send_all (fd, first->payload.data(), first->payload.size());
+      first.reset();
+   }
+   unique_lock<mutex> guard (lock);
+   while (sent) {
+      changed.wait (guard, [&] {
+         return next < first_batch + batches.size()
+             or (closing and shipped == logged);
+      });
+      if (next == first_batch + batches.size()) break;  // all sent
+      vector<shared_ptr<const batch>> sending (
+            batches.begin() + static_cast<ptrdiff_t> (next - first_batch),
+            batches.end());
+      cursors.erase (cursors.find (next));
+      next = first_batch + batches.size();
+      cursors.insert (next);
+      trim_batches();
+      uint64_t primary_seq {logged};
+      guard.unlock();
+      for (const auto& item: sending) {
+         batch_header header {item->header};
+         header.primary_seq = primary_seq;
+         sent = send_all (fd, &header, sizeof header)
+            and send_all (fd, item->payload.data(), item->payload.size());
+         if (not sent) break;  // the follower went away
+      }
+      guard.lock();
+   }
+   cursors.erase (cursors.find (next));
+   trim_batches();
+   --followers;
+   guard.unlock();
+   close (fd);
+}
+
+void log_primary::record (const string& encoded, size_t records) {
+   lock_guard<mutex> guard (lock);
+   pending.append (encoded);
+   logged += records;
+   if (pending.size() >= BATCH_BYTES) changed.notify_all();
+}
+
+size_t log_primary::record_tree (string& out, wordvec& path,
+                                 const string& name, inode_ptr node) {
+   // The records that rebuild node as name in the dir at path: a
+   // mount point as an empty mount filled in, and a quota after the
+   // dir is full.  Pending copies are read without being opened.
+   if (not node->is_dir()) {
+      wordvec words {"make", name};
+      const word_store& data = node->as_file().contents();
+      words.insert (words.end(), data.begin(), data.end());
+      put_words (out, path);
+      put_words (out, words);
+      return 1;
+   }
+   size_t records {1};
+   const directory& dir = node->as_dir();
+   bool mounted = dir.get_space() != dir.parent()->as_dir().get_space();
+   put_words (out, path);
+   put_words (out, {mounted ? "mount" : "mkdir", name});
+   path.push_back (name);
+   for (const auto& entry: dir.read_dirents()) {
+      if (entry.first == "." or entry.first == "..") continue;
+      records += record_tree (out, path, entry.first, entry.second);
+   }
+   path.pop_back();
+   if (node->get_quota() > 0) {
+      put_words (out, path);
+      put_words (out, {"quota", name, to_string (node->get_quota())});
+      ++records;
+   }
+   return records;
+}
+
+void log_primary::record_line (const wordvec& path,
+                               const vector<wordvec>& stages,
+                               const vector<bool>& succeeded) {
+   for (size_t nr = 0; nr < stages.size(); ++nr) {
+      const wordvec& stage = stages[nr];
+      if (stage.empty() or not succeeded.at (nr)
+       or not changes_tree (stage.at(0))) {
+         continue;
+      }
+      // import and mount from a host directory ship what they built
+      const string* built {nullptr};
+      if (stage.at(0) == "import" and stage.size() == 3) {
+         built = &stage.at(2);
+      } else if (stage.at(0) == "mount" and stage.size() == 3) {
+         built = &stage.at(1);
+      }
+      if (built != nullptr) {
+         inode_ptr dir = state.resolve (path);
+         if (dir == nullptr) continue;
+         const directory_entries& entries = dir->as_dir().read_dirents();
+         auto found = entries.find (*built);
+         if (found == entries.end()) continue;
+         wordvec tree_path {path};
+         string encoded;
+         size_t records = record_tree (encoded, tree_path, found->first,
+                                       found->second);
+         record (encoded, records);
+      } else {
+         string encoded;
+         put_words (encoded, path);
+         put_words (encoded, stage);
+         record (encoded, 1);
+      }
+   }
+}
+
+void log_primary::print_lag (ostream& out) {
+   lock_guard<mutex> guard (lock);
+   out << "lag: primary, " << followers << " followers, " << logged
+       << " records logged, " << shipped << " batched, "
+       << batches.size() << " batches kept" << endl;
+}
+
+log_follower::log_follower (const string& path, inode_state& state_):
+               state (state_) {
+   sockaddr_un address {socket_address (path)};
+   fd = socket (AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0
+    or connect (fd, reinterpret_cast<sockaddr*> (&address),
+                sizeof address) < 0) {
+      string error {strerror (errno)};
+      if (fd >= 0) close (fd);
+      throw command_error (path + ": " + error);
+   }
+   applier = thread (&log_follower::apply_loop, this);
+   running_follower = this;
+   DEBUGF ('r', "following " << path);
+}
+
+log_follower::~log_follower() {
+   running_follower = nullptr;
+   shutdown (fd, SHUT_RDWR);
+   applier.join();
+   close (fd);
+}
+
+void log_follower::apply_loop() {
+   batch_header header;
+   string payload;
+   while (recv_all (fd, &header, sizeof header)) {
+      payload.resize (header.payload_bytes);
+      if (not recv_all (fd, payload.data(), payload.size())) break;
+      primary_seq = header.primary_seq;
+      try {
+         lock_guard<mutex> guard (state_lock);
+         record_reader records (payload);
+         while (not records.done()) {
+            wordvec path = records.get_words();
+            wordvec words = records.get_words();
+            apply (path, words);
+         }
+         content_tier::enforce();
+      } catch (runtime_error& error) {
+         complain() << "replica: " << error.what() << endl;
+         break;
+      }
+      applied = header.end_seq;
+      delay_ns = now_ns() - header.created_ns;
+      DEBUGF ('r', "applied " << header.end_seq << " records");
+   }
+   connected = false;
+}
+
+void log_follower::apply (const wordvec& path, const wordvec& words) {
+   // Run the command as the primary did, in a cwd of its own.
+   if (path.empty() or words.empty()) {
+      throw runtime_error ("bad replication record");
+   }
+   command_fn fn = find_command_fn (words.at(0));
+   istringstream no_input;
+   ostream no_output {nullptr};
+   command_io io {no_input, no_output};
+   fs_status status;
+   try {
+      status = state.run_at (path, [&] { return fn (state, words, io); });
+   } catch (command_error& error) {
+      status = fs_status (error.what());
+   } catch (file_error& error) {
+      status = fs_status (error.what());
+   }
+   if (not status.ok()) {
+      complain() << "replica: " << words.at(0) << ": "
+                 << status.message() << endl;
+   }
+}
+
+void log_follower::print_lag (ostream& out) {
+   uint64_t primary {primary_seq};
+   uint64_t done {applied};
+   out << "lag: " << (primary > done ? primary - done : 0)
+       << " records, " << fixed << setprecision (3)
+       << static_cast<double> (delay_ns) / 1e6 << " ms"
+       << (connected ? "" : ", primary gone") << endl;
+   out << defaultfloat;
+}
+
+fs_status print_replication_lag (ostream& out) {
+   if (running_follower != nullptr) {
+      running_follower->print_lag (out);
+   } else if (running_primary != nullptr) {
+      running_primary->print_lag (out);
+   } else {
+      return fs_status ("lag: not replicating");
+   }
+   return {};
+}
+
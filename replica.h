@@ -0,0 +1,141 @@
+// $Id: replica.h,v 1.1 2022-02-12 10:05:41-08 - - $
+
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+
+// Replication -
+//    A primary ships each command that changed its tree to followers
+//    over a Unix socket, as a record of the absolute path of the cwd
+//    it ran in and its words.  A background thread cuts the records
+//    into batches every FLUSH_INTERVAL, or sooner once BATCH_BYTES
+//    are waiting.  Followers replay the batches in order on their own
+//    thread and serve only commands that leave the tree alone.
+//    import, and mount with a host directory, are shipped as the
+//    mkdir, make and mount records that rebuild their result, since a
+//    follower may not see the host directory as the primary did.  A follower that connects after the primary has
+//    dropped batches gets the same kind of records for the whole tree
+//    first, as of the last record logged, and numbers its inodes in
+//    the order they rebuild it.
+//
+// Batch layout on the socket, in host byte order:
+//    a batch_header, then payload_bytes of records, each one the path
+//    word count, the path words, the word count, and the words, where
+//    every count and length is an unsigned LEB128 varint.
+
+struct batch_header {
+   uint64_t end_seq;        // records up to and including this batch
+   uint64_t primary_seq;    // records logged by the primary when sent
+   int64_t created_ns;      // when the batch was cut, system clock
+   uint64_t payload_bytes;
+};
+
+// class log_primary -
+//    Listens on the socket path and keeps each batch only until every
+//    connected follower has been sent it.  A follower that connects
+//    before any batch was dropped replays from the start; one that
+//    connects later is sent a snapshot of the tree, built between
+//    lines under state_lock, which the shell takes around every line
+//    it runs.  Each follower gets its own sender thread, so a slow
+//    one never holds up the shell.  The destructor ships what is left
+//    and closes the socket.
+// record_line -
+//    Logs the stages of a line that succeeded, as given by succeeded
+//    (see run_pipeline), given the cwd_path it started in.  Only
+//    stages that change the tree are kept.
+
+class log_primary {
+   private:
+      struct batch {
+         batch_header header;
+         string payload;
+      };
+      static constexpr size_t BATCH_BYTES {64 * 1024};
+      static constexpr chrono::milliseconds FLUSH_INTERVAL {2};
+      string socket_path;
+      int listen_fd {-1};
+      mutex lock;
+      condition_variable changed;
+      string pending;
+      uint64_t logged {0};
+      uint64_t shipped {0};
+      deque<shared_ptr<const batch>> batches;
+      size_t first_batch {0};     // number of batches.front()
+      multiset<size_t> cursors;   // next batch of each follower
+      size_t followers {0};
+      bool closing {false};
+      thread acceptor;
+      thread batcher;
+      vector<thread> senders;
+      inode_state& state;
+      void accept_loop();
+      void batch_loop();
+      void cut_batch();
+      void trim_batches();
+      void send_loop (int fd, size_t next, shared_ptr<const batch> first);
+      void record (const string& encoded, size_t records);
+      size_t record_tree (string& out, wordvec& path, const string& name,
+                          inode_ptr node);
+   public:
+      mutex state_lock;
+      log_primary (const string& path, inode_state& state_);
+      log_primary (const log_primary&) = delete;
+      log_primary& operator= (const log_primary&) = delete;
+      ~log_primary();
+      void record_line (const wordvec& path,
+                        const vector<wordvec>& stages,
+                        const vector<bool>& succeeded);
+      void print_lag (ostream& out);
+};
+
+// class log_follower -
+//    Connects to a primary's socket and applies its batches in the
+//    background, each under state_lock.  The shell takes the same
+//    lock around every line it runs.
+// print_lag -
+//    Records the primary had logged, as of the last batch received,
+//    that are not applied yet, and how long after being cut the last
+//    batch was applied.
+
+class log_follower {
+   private:
+      inode_state& state;
+      int fd {-1};
+      thread applier;
+      atomic<uint64_t> applied {0};
+      atomic<uint64_t> primary_seq {0};
+      atomic<int64_t> delay_ns {0};
+      atomic<bool> connected {true};
+      void apply_loop();
+      void apply (const wordvec& path, const wordvec& words);
+   public:
+      mutex state_lock;
+      log_follower (const string& path, inode_state& state_);
+      log_follower (const log_follower&) = delete;
+      log_follower& operator= (const log_follower&) = delete;
+      ~log_follower();
+      void print_lag (ostream& out);
+};
+
+// print_replication_lag -
+//    print_lag for the primary or follower this process is running
+//    as, for the lag command.
+
+fs_status print_replication_lag (ostream& out);
+
+#endif
+
@@ -0,0 +1,53 @@
+#!/bin/sh
+# $Id: runtests.sh,v 1.1 2022-02-18 09:12:40-08 - - $
+#
+# runtests.sh binary test... -
+#    Runs each test and compares what it prints, stdout and stderr
+#    together, with the .out file next to it.  A test.ysh is a script
+#    for binary; a first line "# options: ..." gives the shell options
+#    to run it with.  A test.sh is a sh script, for tests that need
+#    more than one shell, run with $YSHELL and $YSH_REPLAY naming the
+#    shell and the ysh_replay next to it.  Each test runs in a scratch
+#    directory of its own, holding a copy of tests/host, and the
+#    "build" line every shell starts with is dropped.  Prints the diff
+#    of each test that differs, and exits 1 if any did.
+#
+
+binary=$1
+shift
+case "$binary" in
+   /*) ;;
+   *) binary="$(pwd)/$binary" ;;
+esac
+here=$(cd "$(dirname "$0")" && pwd)
+failed=0
+for test in "$@"; do
+   case "$test" in
+      /*) ;;
+      *) test="$(pwd)/$test" ;;
+   esac
+   name=$(basename "$test")
+   scratch=$(mktemp -d "${TMPDIR:-/tmp}/yshell-test-XXXXXX") || exit 1
+   if [ -d "$here/tests/host" ]; then
+      cp -R "$here/tests/host" "$scratch/host"
+   fi
+   ln -s "$binary" "$scratch/yshell"
+   ln -s "$(dirname "$binary")/ysh_replay" "$scratch/ysh_replay"
+   case "$test" in
+      *.ysh)
+         options=$(sed -n '1s/^# options: //p' "$test")
+         (cd "$scratch" && ./yshell $options <"$test" 2>&1) ;;
+      *.sh)
+         (cd "$scratch" && YSHELL=./yshell YSH_REPLAY=./ysh_replay \
+                           sh "$test" 2>&1) ;;
+   esac | sed '/^[^ ]*yshell build /d' >"$scratch/actual"
+   if diff "${test%.*}.out" "$scratch/actual" >"$scratch/diff"; then
+      echo "$name: ok"
+   else
+      echo "$name: FAILED"
+      cat "$scratch/diff"
+      failed=1
+   fi
+   rm -rf "$scratch"
+done
+exit $failed
@@ -0,0 +1,14 @@
+# bytecode: yshell -c compiles a script once and yshell -r replays it,
+# printing just what the interpreter prints for the same script,
+# syntax and unknown command errors included
+printf 'mkdir d\ncd d\nmake f b a c a\ncat f | sort | uniq\n' >script
+printf 'append f d\nhead -n 2 f\nnosuch x\ncat f |\n| wc\ncd /\n' >>script
+printf 'ls d\nrm d\n' >>script
+$YSHELL <script >interpreted 2>&1
+$YSHELL -c script.ysb <script 2>&1
+$YSHELL -r script.ysb >replayed 2>&1
+cat replayed
+diff interpreted replayed && echo same
+printf 'not bytecode\n' >bad.ysb
+$YSHELL -r bad.ysb
+$YSHELL -r nosuch.ysb
@@ -0,0 +1,18 @@
+# import: reads a host directory into the tree, following links to
+# files but not links to directories, so a link back up cannot loop,
+# and skipping dangling links; export writes a tree back out
+mkdir -p host/sub
+printf 'hello world\nsecond line\n' >host/a.txt
+printf 'x\n' >host/sub/b
+ln -s ../a.txt host/sub/link
+ln -s .. host/sub/up
+ln -s nowhere host/dangling
+printf 'import host h\nls h\ncd h\ncat a.txt\nls sub\ncd sub\ncat link b\n' \
+       >script
+printf 'cd /\nexport h out\nimport out h2\ndiff h h2\nimport host h\n' \
+       >>script
+printf 'import nosuch z\nexport nosuch y\nquota / 100\nimport host q\n' \
+       >>script
+$YSHELL <script 2>&1
+find out | sort
+cat out/a.txt out/sub/link
@@ -0,0 +1,49 @@
+# replication: a follower connected from the start replays the log,
+# one that connects after the primary dropped the batches it had
+# sent starts from a snapshot, and a stage that succeeded is shipped
+# even when another stage of its line failed; the followers run in a
+# directory of their own, where the host directory the primary mounts
+# is not to be seen
+mkfifo primary.in first.in second.in
+mkdir -p hostm/sub follower
+printf 'kept words\n' >hostm/w
+printf 'more\n' >hostm/sub/v
+$YSHELL -P sock <primary.in >primary.out 2>&1 &
+exec 3>primary.in
+while [ ! -S sock ]; do sleep 0.1; done
+(cd follower && ../$YSHELL -F ../sock <../first.in >../first.out 2>&1) &
+exec 4>first.in
+sleep 0.5
+
+printf 'mkdir a\ncd a\nmake f one two\nmkdir b\ncd /\n' >&3
+printf 'ls nosuch | make g three\nquota a 100000\ncp -r a c\n' >&3
+printf 'mount m\ncd m\nmake x in m\ncd /\nmount hm hostm\n' >&3
+sleep 1
+printf 'lag\n' >&3
+sleep 0.5
+(cd follower && ../$YSHELL -F ../sock <../second.in >../second.out 2>&1) &
+exec 5>second.in
+sleep 0.5
+printf 'cd c\nmake h four\ncd /\n' >&3
+sleep 1
+printf 'lag\n' >&3
+sleep 0.5
+
+for fd in 4 5; do
+   printf 'ls\nls a\nls c\ncat g\ndf a\ncd m\ncat x\ncd /\nmkdir no\n' >&$fd
+   printf 'cd hm\nls sub\ncat w\ncd /\n' >&$fd
+done
+exec 4>&- 5>&-
+wait_for() {
+   while ! grep -q '\^D' "$1"; do sleep 0.1; done
+}
+wait_for first.out
+wait_for second.out
+printf 'ls\nls a\nls c\ncat g\ndf a\ncd m\ncat x\ncd /\n' >&3
+printf 'mount\ncd hm\nls sub\ncat w\ncd /\n' >&3
+exec 3>&-
+wait
+for out in primary first second; do
+   echo "== $out"
+   cat $out.out
+done
@@ -0,0 +1,19 @@
+# trace: yshell -t records every line with its timing, and ysh_replay
+# runs the trace again with the shell options it was recorded under,
+# here -i, failing the same lines; the timings are masked out
+printf 'mkdir a\ncd a\nmake f one two\ncat f\ncat nosuch\nsearch one\n' \
+       >script
+printf 'cd /\nls a\ncd a\ncat f\nsearch one\nexit\n' >>script
+$YSHELL -i -t trace.bin <script >/dev/null 2>&1
+mask() {
+   sed -e 's/  *[0-9][0-9]*\.[0-9][0-9]*/ T/g' -e '/^most late start/d'
+}
+$YSH_REPLAY trace.bin | mask
+$YSH_REPLAY -s 0 trace.bin | mask
+head -c 20 trace.bin >short.bin
+$YSH_REPLAY short.bin | mask
+printf 'not a trace\n' >bad.bin
+$YSH_REPLAY bad.bin
+$YSH_REPLAY nosuch
+$YSH_REPLAY -s x trace.bin
+$YSH_REPLAY
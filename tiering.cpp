@@ -0,0 +1,279 @@
+// $Id: tiering.cpp,v 1.1 2022-02-13 15:21:08-08 - - $
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "file_sys.h"
+#include "tiering.h"
+#include "word_store.h"
+
+mutex content_tier::lock;
+size_t content_tier::budget_ {0};
+size_t content_tier::resident_ {0};
+vector<word_store*> content_tier::ring;
+size_t content_tier::hand {0};
+int content_tier::spill_fd {-1};
+size_t content_tier::spill_end {0};
+map<size_t,size_t> content_tier::free_at;
+multimap<size_t,size_t> content_tier::free_sized;
+size_t content_tier::free_bytes {0};
+size_t content_tier::hits {0};
+size_t content_tier::misses {0};
+size_t content_tier::evictions {0};
+size_t content_tier::spill_writes {0};
+
+// Spilled layout: chunk count, then per chunk its word count and
+// each word as length and bytes, all counts as LEB128 varints.
+
+static void put_varint (string& out, size_t value) {
+   while (value >= 0x80) {
+      out.push_back (static_cast<char> ((value & 0x7F) | 0x80));
+      value >>= 7;
+   }
+   out.push_back (static_cast<char> (value));
+}
+
+static size_t get_varint (const string& in, size_t& pos) {
+   size_t value {0};
+   for (int shift = 0; shift < 64 and pos < in.size(); shift += 7) {
+      unsigned char byte = static_cast<unsigned char> (in[pos++]);
+      value |= static_cast<size_t> (byte & 0x7F) << shift;
+      if (not (byte & 0x80)) return value;
+   }
+   throw file_error ("spill file is corrupt");
+}
+
+void content_tier::budget (size_t bytes) {
+   const char* tmpdir = getenv ("TMPDIR");
+   string name {string (tmpdir != nullptr ? tmpdir : "/tmp")
+                + "/yshell-spill-XXXXXX"};
+   spill_fd = mkstemp (name.data());
+   if (spill_fd < 0) {
+      throw command_error (name + ": " + strerror (errno));
+   }
+   unlink (name.c_str());  // gone when the shell exits
+   budget_ = bytes;
+   DEBUGF ('t', "budget " << bytes << ", spill file " << name);
+}
+
+void content_tier::admit (word_store& store) {
+   lock_guard<mutex> guard (lock);
+   store.tier.index = ring.size();
+   store.tier.referenced = true;
+   ring.push_back (&store);
+   resident_ += store.bytes();
+}
+
+void content_tier::forget (word_store& store) {
+   lock_guard<mutex> guard (lock);
+   if (not store.tier.spilled) resident_ -= store.bytes();
+   give_extent (store.tier);
+   // Move the last store into the hole.
+   size_t index = store.tier.index;
+   ring[index] = ring.back();
+   ring[index]->tier.index = index;
+   ring.pop_back();
+   store.tier.index = tier_slot::NONE;
+}
+
+void content_tier::resized (word_store& store, size_t old_bytes) {
+   lock_guard<mutex> guard (lock);
+   store.tier.spill_clean = false;
+   give_extent (store.tier);
+   if (store.tier.spilled) {
+      // Only assign changes a spilled store, dropping its words.
+      store.tier.spilled = false;
+      resident_ += store.bytes();
+   } else {
+      resident_ += store.bytes() - old_bytes;
+   }
+}
+
+void content_tier::touch (word_store& store) {
+   if (not enabled()) return;
+   lock_guard<mutex> guard (lock);
+   store.tier.referenced = true;
+   if (store.tier.spilled) {
+      ++misses;
+      load (store);
+   } else {
+      ++hits;
+   }
+}
+
+void content_tier::page_in (word_store& store) {
+   if (not enabled()) return;
+   lock_guard<mutex> guard (lock);
+   if (store.tier.spilled) load (store);
+}
+
+size_t content_tier::take_extent (size_t bytes) {
+   // The smallest free extent that fits, its rest left free, or new
+   // space at the end of the file.
+   auto fit = free_sized.lower_bound (bytes);
+   if (fit == free_sized.end()) {
+      size_t offset = spill_end;
+      spill_end += bytes;
+      return offset;
+   }
+   size_t offset = fit->second;
+   size_t rest = fit->first - bytes;
+   free_sized.erase (fit);
+   free_at.erase (offset);
+   free_bytes -= bytes;
+   if (rest > 0) {
+      free_at.emplace (offset + bytes, rest);
+      free_sized.emplace (rest, offset + bytes);
+   }
+   return offset;
+}
+
+void content_tier::give_extent (tier_slot& slot) {
+   if (slot.spill_bytes == 0) return;
+   size_t offset = slot.spill_offset;
+   size_t bytes = slot.spill_bytes;
+   slot.spill_bytes = 0;
+   slot.spill_clean = false;
+   free_bytes += bytes;
+   auto unlink_free = [] (map<size_t,size_t>::iterator extent) {
+      auto range = free_sized.equal_range (extent->second);
+      for (auto sized = range.first; sized != range.second; ++sized) {
+         if (sized->second == extent->first) {
+            free_sized.erase (sized);
+            break;
+         }
+      }
+      free_at.erase (extent);
+   };
+   auto next = free_at.find (offset + bytes);
+   if (next != free_at.end()) {
+      bytes += next->second;
+      unlink_free (next);
+   }
+   auto prev = free_at.lower_bound (offset);
+   if (prev != free_at.begin()) {
+      --prev;
+      if (prev->first + prev->second == offset) {
+         offset = prev->first;
+         bytes += prev->second;
+         unlink_free (prev);
+      }
+   }
+   if (offset + bytes == spill_end) {
+      spill_end = offset;
+      free_bytes -= bytes;
+      if (ftruncate (spill_fd, static_cast<off_t> (spill_end)) < 0) {
+         DEBUGF ('t', "ftruncate: " << strerror (errno));
+      }
+      return;
+   }
+   free_at.emplace (offset, bytes);
+   free_sized.emplace (bytes, offset);
+}
+
+void content_tier::spill (word_store& store) {
+   if (not store.tier.spill_clean) {
+      string image;
+      put_varint (image, store.chunks.size());
+      for (const auto& chunk: store.chunks) {
+         put_varint (image, chunk.size());
+         for (const auto& word: chunk) {
+            put_varint (image, word.size());
+            image.append (word);
+         }
+      }
+      store.tier.spill_offset = take_extent (image.size());
+      store.tier.spill_bytes = image.size();
+      size_t done {0};
+      while (done < image.size()) {
+         ssize_t put = pwrite (spill_fd, image.data() + done,
+                               image.size() - done,
+                               static_cast<off_t> (store.tier.spill_offset
+                                                   + done));
+         if (put < 0 and errno == EINTR) continue;
+         if (put <= 0) {
+            string error {strerror (errno)};
+            give_extent (store.tier);
+            throw command_error ("spill file: " + error);
+         }
+         done += static_cast<size_t> (put);
+      }
+      store.tier.spill_clean = true;
+      ++spill_writes;
+   }
+   vector<wordvec>().swap (store.chunks);
+   store.tier.spilled = true;
+   resident_ -= store.bytes();
+   ++evictions;
+}
+
+void content_tier::load (word_store& store) {
+   string image (store.tier.spill_bytes, '\0');
+   size_t done {0};
+   while (done < image.size()) {
+      ssize_t got = pread (spill_fd, image.data() + done,
+                           image.size() - done,
+                           static_cast<off_t> (store.tier.spill_offset
+                                               + done));
+      if (got < 0 and errno == EINTR) continue;
+      if (got <= 0) throw file_error ("spill file is short");
+      done += static_cast<size_t> (got);
+   }
+   size_t pos {0};
+   store.chunks.resize (get_varint (image, pos));
+   for (auto& chunk: store.chunks) {
+      chunk.resize (get_varint (image, pos));
+      for (auto& word: chunk) {
+         size_t length = get_varint (image, pos);
+         if (length > image.size() - pos) {
+            throw file_error ("spill file is corrupt");
+         }
+         word.assign (image, pos, length);
+         pos += length;
+      }
+   }
+   store.tier.spilled = false;
+   resident_ += store.bytes();
+}
+
+void content_tier::enforce() {
+   if (not enabled()) return;
+   lock_guard<mutex> guard (lock);
+   // Two sweeps clear every referenced bit and spill all they can.
+   for (size_t step = 0; step < 2 * ring.size() and resident_ > budget_;
+        ++step) {
+      if (hand >= ring.size()) hand = 0;
+      word_store& store = *ring[hand++];
+      if (store.tier.spilled or store.empty()) continue;
+      if (store.tier.referenced) {
+         store.tier.referenced = false;
+      } else {
+         spill (store);
+      }
+   }
+   DEBUGF ('t', resident_ << " bytes resident");
+}
+
+void content_tier::print_stats (ostream& out) {
+   lock_guard<mutex> guard (lock);
+   size_t spilled {0};
+   for (const word_store* store: ring) {
+      if (store->tier.spilled) ++spilled;
+   }
+   out << "budget " << budget_ << " bytes, " << resident_
+       << " resident" << endl;
+   out << ring.size() << " stores, " << spilled << " spilled, "
+       << spill_end << " bytes in spill file, " << free_bytes
+       << " free" << endl;
+   out << hits << " hits, " << misses << " misses, " << evictions
+       << " evictions, " << spill_writes << " spill writes" << endl;
+}
+
@@ -0,0 +1,97 @@
+// $Id: tiering.h,v 1.1 2022-02-13 15:21:08-08 - - $
+
+#ifndef TIERING_H
+#define TIERING_H
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+class word_store;
+
+// tier_slot -
+//    A word store's place in the CLOCK ring, and the extent of the
+//    spill file that holds its words, with spill_bytes 0 while it
+//    holds none.  spill_clean means the extent still holds exactly
+//    the current words, so spilling again needs no write; an edit
+//    gives the extent back at once.
+
+struct tier_slot {
+   static constexpr size_t NONE {SIZE_MAX};
+   size_t index {NONE};
+   bool referenced {false};
+   bool spilled {false};
+   bool spill_clean {false};
+   size_t spill_offset {0};
+   size_t spill_bytes {0};
+};
+
+// class content_tier -
+//    Keeps the words of plain files within a memory budget by
+//    spilling the least recently used word stores to an unlinked
+//    temporary file, chosen by the CLOCK approximation of LRU, and
+//    reading them back the next time they are used.  Everything else
+//    about a store, its counts, bytes and hash, stays resident, so
+//    ls, wc sizes, df and diff never read the spill file.
+// budget -
+//    Turns tiering on with a budget in bytes, before any files are
+//    made.  With no budget every word stays in memory.
+// admit, forget, resized -
+//    Called by word_store as stores are made, destroyed and edited,
+//    to keep the count of resident bytes exact, and to give back the
+//    spill extents of stores that no longer need them.
+// touch -
+//    Marks a store as used by a command and reads it back if it was
+//    spilled, counting a hit or a miss.
+// page_in -
+//    Reads a store back if it was spilled, for the shell's own use
+//    of its words, as in accounting, indexing or replication, which
+//    counts as neither a hit nor a use.  touch or page_in must precede
+//    any use of a store's words.
+// Spill file -
+//    Extents given back are kept in a free list, coalesced with
+//    their neighbors, and a spill takes the smallest one that fits,
+//    so the file grows only when none does.  A free extent at the
+//    end of the file is cut off it.
+// enforce -
+//    Spills stores until the resident bytes fit the budget.  Only
+//    called between commands, so no command holds words that could
+//    be spilled out from under it.
+
+class content_tier {
+   private:
+      static mutex lock;
+      static size_t budget_;
+      static size_t resident_;
+      static vector<word_store*> ring;
+      static size_t hand;
+      static int spill_fd;
+      static size_t spill_end;
+      static map<size_t,size_t> free_at;          // offset -> bytes
+      static multimap<size_t,size_t> free_sized;  // bytes -> offset
+      static size_t free_bytes;
+      static size_t hits;
+      static size_t misses;
+      static size_t evictions;
+      static size_t spill_writes;
+      static void spill (word_store& store);
+      static void load (word_store& store);
+      static size_t take_extent (size_t bytes);
+      static void give_extent (tier_slot& slot);
+   public:
+      static void budget (size_t bytes);
+      static bool enabled() { return budget_ > 0; }
+      static void admit (word_store& store);
+      static void forget (word_store& store);
+      static void resized (word_store& store, size_t old_bytes);
+      static void touch (word_store& store);
+      static void page_in (word_store& store);
+      static void enforce();
+      static void print_stats (ostream& out);
+};
+
+#endif
+
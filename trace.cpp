@@ -0,0 +1,112 @@
+// $Id: trace.cpp,v 1.1 2022-02-17 10:04:31-08 - - $
+
+#include <stdexcept>
+
+#include "debug.h"
+#include "file_sys.h"
+#include "trace.h"
+
+static const string MAGIC {"YSHT1\n"};
+
+static void put_varint (ostream& out, uint64_t value) {
+   while (value >= 0x80) {
+      out.put (static_cast<char> ((value & 0x7F) | 0x80));
+      value >>= 7;
+   }
+   out.put (static_cast<char> (value));
+}
+
+static uint64_t get_varint (istream& in) {
+   uint64_t value {0};
+   for (int shift = 0; shift < 64; shift += 7) {
+      int byte = in.get();
+      if (byte == EOF) throw runtime_error ("truncated trace");
+      value |= static_cast<uint64_t> (byte & 0x7F) << shift;
+      if (not (byte & 0x80)) return value;
+   }
+   throw runtime_error ("bad varint in trace");
+}
+
+static uint64_t nanoseconds (trace_clock::duration span) {
+   return chrono::duration_cast<chrono::nanoseconds> (span).count();
+}
+
+trace_writer::trace_writer (const string& path, bool word_index,
+                            size_t memory):
+              out (path, ios::binary), origin (trace_clock::now()) {
+   if (not out) throw command_error (path + ": cannot write trace");
+   out << MAGIC;
+   put_varint (out, word_index ? 1 : 0);
+   put_varint (out, memory);
+}
+
+void trace_writer::record (const string& line,
+                           trace_clock::time_point start,
+                           trace_clock::time_point end, bool failed) {
+   uint64_t start_ns = nanoseconds (start - origin);
+   put_varint (out, start_ns - last_start_ns);
+   put_varint (out, nanoseconds (end - start));
+   put_varint (out, failed ? 1 : 0);
+   last_start_ns = start_ns;
+   auto [id, added] = ids.emplace (line, ids.size());
+   put_varint (out, id->second);
+   if (added) {
+      put_varint (out, line.size());
+      out << line;
+   }
+   DEBUGF ('T', "line " << id->second << ": " << line);
+}
+
+trace_line::trace_line (trace_writer* writer_, const string& line_):
+            writer (writer_), line (line_) {
+   if (writer != nullptr) start = trace_clock::now();
+}
+
+trace_line::~trace_line() {
+   if (writer != nullptr) {
+      writer->record (line, start, trace_clock::now(), true);
+   }
+}
+
+void trace_line::done (bool ok) {
+   if (writer == nullptr) return;
+   writer->record (line, start, trace_clock::now(), not ok);
+   writer = nullptr;
+}
+
+trace_file load_trace (istream& in) {
+   string magic (MAGIC.size(), '\0');
+   in.read (magic.data(), static_cast<streamsize> (magic.size()));
+   if (magic != MAGIC) {
+      throw runtime_error ("not a yshell trace");
+   }
+   trace_file trace;
+   trace.word_index = get_varint (in) != 0;
+   trace.memory = get_varint (in);
+   wordvec lines;
+   uint64_t start_ns {0};
+   while (in.peek() != EOF) {
+      trace_record record;
+      start_ns += get_varint (in);
+      record.start_ns = start_ns;
+      record.latency_ns = get_varint (in);
+      record.failed = get_varint (in) != 0;
+      size_t id = get_varint (in);
+      if (id == lines.size()) {
+         string text (get_varint (in), '\0');
+         in.read (text.data(), static_cast<streamsize> (text.size()));
+         if (in.gcount() != static_cast<streamsize> (text.size())) {
+            throw runtime_error ("truncated trace");
+         }
+         lines.push_back (move (text));
+      } else if (id > lines.size()) {
+         throw runtime_error ("bad line id in trace");
+      }
+      record.line = lines[id];
+      trace.records.push_back (move (record));
+   }
+   DEBUGF ('T', trace.records.size() << " records, "
+           << lines.size() << " distinct lines");
+   return trace;
+}
+
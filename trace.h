@@ -0,0 +1,95 @@
+// $Id: trace.h,v 1.1 2022-02-17 10:04:31-08 - - $
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Trace file layout, all integers as unsigned LEB128 varints:
+//    magic "YSHT1\n"
+//    header:  1 if the word index was on (-i), else 0, then the
+//             memory budget in bytes (-m), 0 for none
+//    records, one per command line, until end of file:
+//       nanoseconds since the previous line started (the first line:
+//       since the trace started), nanoseconds the line took, 1 if it
+//       failed, else 0, and the line's text id.  An id one past the
+//       last one seen is a new line, followed by its length and
+//       bytes; any other repeats an earlier line.
+// A session repeats most of its lines, and each repeat costs a few
+// bytes.
+
+using trace_clock = chrono::steady_clock;
+
+// struct trace_record -
+//    One command line as recorded, with times in nanoseconds.
+
+struct trace_record {
+   uint64_t start_ns;     // from the start of the trace
+   uint64_t latency_ns;
+   bool failed;
+   string line;
+};
+
+// struct trace_file -
+//    A loaded trace: the shell options that shape its results, and
+//    its lines in the order they ran.
+
+struct trace_file {
+   bool word_index {false};
+   size_t memory {0};
+   vector<trace_record> records;
+};
+
+// class trace_writer -
+//    Writes a trace of the lines a shell runs to path.  Records are
+//    buffered, and the trace is complete once the writer is
+//    destroyed.  Throws a command_error if path can not be written.
+// record -
+//    Adds a line that ran from start to end.
+
+class trace_writer {
+   private:
+      ofstream out;
+      trace_clock::time_point origin;
+      uint64_t last_start_ns {0};
+      unordered_map<string,size_t> ids;
+   public:
+      trace_writer (const string& path, bool word_index, size_t memory);
+      trace_writer (const trace_writer&) = delete;
+      trace_writer& operator= (const trace_writer&) = delete;
+      void record (const string& line, trace_clock::time_point start,
+                   trace_clock::time_point end, bool failed);
+};
+
+// class trace_line -
+//    Times one line for a trace_writer, or does nothing without one.
+//    done records the line when it returns, or when it exits the
+//    shell; a line that throws anything else is recorded as failed
+//    when the trace_line is destroyed.
+
+class trace_line {
+   private:
+      trace_writer* writer;
+      const string& line;
+      trace_clock::time_point start;
+   public:
+      trace_line (trace_writer* writer_, const string& line_);
+      trace_line (const trace_line&) = delete;
+      trace_line& operator= (const trace_line&) = delete;
+      ~trace_line();
+      void done (bool ok);
+};
+
+// load_trace -
+//    Reads a whole trace.  Throws a runtime_error if in is not one.
+
+trace_file load_trace (istream& in);
+
+#endif
+
@@ -7,6 +7,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -64,6 +66,44 @@ wordvec split (const string& line, const string& delimiter);
 
 ostream& complain();
 
+// content hashes -
+//    Arithmetic in the field of integers modulo the prime 2^61-1,
+//    used for the content hashes of files and directories.
+//    word_hash maps a string to a nonzero element, so a word never
+//    hashes like an absent one.
+
+constexpr uint64_t HASH_PRIME {(uint64_t {1} << 61) - 1};
+
+inline uint64_t hash_add (uint64_t a, uint64_t b) {
+   uint64_t sum {a + b};
+   return sum >= HASH_PRIME ? sum - HASH_PRIME : sum;
+}
+
+inline uint64_t hash_sub (uint64_t a, uint64_t b) {
+   return a >= b ? a - b : a + HASH_PRIME - b;
+}
+
+inline uint64_t hash_mul (uint64_t a, uint64_t b) {
+   __extension__ using uint128 = unsigned __int128;
+   uint128 product {static_cast<uint128> (a) * b};
+   uint64_t low {static_cast<uint64_t> (product) & HASH_PRIME};
+   uint64_t high {static_cast<uint64_t> (product >> 61)};
+   return hash_add (low, high);
+}
+
+inline uint64_t hash_pow (uint64_t base, size_t exponent) {
+   uint64_t result {1};
+   for (; exponent > 0; exponent >>= 1) {
+      if (exponent & 1) result = hash_mul (result, base);
+      base = hash_mul (base, base);
+   }
+   return result;
+}
+
+inline uint64_t word_hash (const string& word) {
+   return hash<string>{} (word) % (HASH_PRIME - 1) + 1;
+}
+
 // operator<< (vector) -
 //    An overloaded template operator which allows vectors to be
 //    printed out as a single operator, each element separated from
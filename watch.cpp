@@ -0,0 +1,87 @@
+// $Id: watch.cpp,v 1.1 2022-02-15 09:48:12-08 - - $
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+using namespace std;
+
+#include "debug.h"
+#include "watch.h"
+
+ostream& operator<< (ostream& out, fs_event_kind kind) {
+   switch (kind) {
+      case fs_event_kind::CREATED: out << "created"; break;
+      case fs_event_kind::WRITTEN: out << "written"; break;
+      case fs_event_kind::REMOVED: out << "removed"; break;
+      case fs_event_kind::LOST: out << "lost"; break;
+      default: assert (false);
+   }
+   return out;
+}
+
+event_queue::event_queue (size_t capacity, size_t watched_nr_):
+             slots (bit_ceil (max<size_t> (capacity, 1))),
+             mask (slots.size() - 1), watched_nr (watched_nr_) {
+}
+
+void event_queue::push (const fs_event& event) {
+   size_t at = tail.load (memory_order_relaxed);
+   if (at - head.load (memory_order_acquire) == slots.size()) {
+      lost.fetch_add (1, memory_order_relaxed);
+      return;
+   }
+   slots[at & mask] = event;
+   tail.store (at + 1, memory_order_release);
+}
+
+size_t event_queue::poll (vector<fs_event>& events) {
+   size_t first = head.load (memory_order_relaxed);
+   size_t last = tail.load (memory_order_acquire);
+   for (size_t at = first; at != last; ++at) {
+      events.push_back (move (slots[at & mask]));
+   }
+   head.store (last, memory_order_release);
+   size_t count = last - first;
+   if (lost.exchange (0, memory_order_relaxed) > 0) {
+      events.push_back ({fs_event_kind::LOST, watched_nr, "", 0});
+      ++count;
+   }
+   return count;
+}
+
+shared_ptr<event_queue> watch_table::subscribe (size_t dir_nr,
+                                                bool recursive,
+                                                size_t capacity) {
+   DEBUGF ('n', "dir " << dir_nr << ", recursive " << recursive);
+   auto queue = make_shared<event_queue> (capacity, dir_nr);
+   watches[dir_nr].push_back ({recursive, queue});
+   return queue;
+}
+
+void watch_table::deliver (size_t dir_nr, bool direct,
+                           const fs_event& event) {
+   auto found = watches.find (dir_nr);
+   if (found == watches.end()) return;
+   vector<subscription>& subscriptions = found->second;
+   bool ended {false};
+   for (const auto& watch: subscriptions) {
+      shared_ptr<event_queue> queue = watch.queue.lock();
+      if (queue == nullptr) {
+         ended = true;
+      } else if (direct or watch.recursive) {
+         queue->push (event);
+      }
+   }
+   if (ended) {
+      erase_if (subscriptions, [] (const subscription& watch) {
+         return watch.queue.expired();
+      });
+      if (subscriptions.empty()) watches.erase (found);
+   }
+}
+
+void watch_table::forget (size_t dir_nr) {
+   watches.erase (dir_nr);
+}
+
@@ -0,0 +1,86 @@
+// $Id: watch.h,v 1.1 2022-02-15 09:48:12-08 - - $
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// struct fs_event -
+//    One change seen by a watch: an entry name of directory dir_nr,
+//    with inode inode_nr, was created, written or removed.  LOST
+//    stands for every event that did not fit in a full queue, with
+//    dir_nr the watched directory, which must be listed again.
+
+enum class fs_event_kind {CREATED, WRITTEN, REMOVED, LOST};
+ostream& operator<< (ostream&, fs_event_kind);
+
+struct fs_event {
+   fs_event_kind kind;
+   size_t dir_nr;
+   string name;
+   size_t inode_nr;
+};
+
+// class event_queue -
+//    Bounded single-producer single-consumer ring of the events of
+//    one watch.  Neither side ever blocks or takes a lock: the thread
+//    changing the tree pushes, and the watcher polls from any thread.
+//    When the ring is full, further events are coalesced into one
+//    LOST event, delivered after the ones that fit.
+// poll -
+//    Moves every pending event to the end of events and returns how
+//    many it moved.
+
+class event_queue {
+   private:
+      vector<fs_event> slots;
+      size_t mask;
+      size_t watched_nr;
+      atomic<size_t> head {0};   // next slot to poll, consumer only
+      atomic<size_t> tail {0};   // next slot to push, producer only
+      atomic<size_t> lost {0};   // events dropped since the last poll
+   public:
+      event_queue (size_t capacity, size_t watched_nr_);
+      event_queue (const event_queue&) = delete;
+      event_queue& operator= (const event_queue&) = delete;
+      void push (const fs_event& event);
+      size_t poll (vector<fs_event>& events);
+};
+
+// class watch_table -
+//    The watches on each directory, by inode number, which is never
+//    reused, so a removed directory can not pass its watches on.
+//    Only the thread changing the tree uses the table.  A watch ends
+//    when its watcher drops the queue.
+// subscribe -
+//    Starts a watch of the directory dir_nr: of its own entries, or
+//    with recursive, of every directory below it as well.
+// deliver -
+//    Pushes event to the watches on dir_nr: all of them if the event
+//    is in that directory itself (direct), else the recursive ones.
+// forget -
+//    Ends the watches on a removed directory.
+
+class watch_table {
+   private:
+      struct subscription {
+         bool recursive;
+         weak_ptr<event_queue> queue;
+      };
+      unordered_map<size_t,vector<subscription>> watches;
+   public:
+      bool empty() const { return watches.empty(); }
+      shared_ptr<event_queue> subscribe (size_t dir_nr, bool recursive,
+                                         size_t capacity);
+      void deliver (size_t dir_nr, bool direct, const fs_event& event);
+      void forget (size_t dir_nr);
+};
+
+#endif
+
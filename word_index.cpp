@@ -0,0 +1,108 @@
+// $Id: word_index.cpp,v 1.1 2022-02-06 14:02:11-08 - - $
+
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+
+#include "debug.h"
+#include "word_index.h"
+
+void word_index::put_varint (string& bytes, size_t value) {
+   while (value >= 0x80) {
+      bytes.push_back (static_cast<char> ((value & 0x7F) | 0x80));
+      value >>= 7;
+   }
+   bytes.push_back (static_cast<char> (value));
+}
+
+void word_index::decode (const postings& list, vector<size_t>& out) {
+   out.clear();
+   out.reserve (list.count);
+   size_t value {0};
+   size_t delta {0};
+   int shift {0};
+   for (const char byte: list.bytes) {
+      auto bits = static_cast<unsigned char> (byte);
+      delta |= static_cast<size_t> (bits & 0x7F) << shift;
+      if (bits & 0x80) {
+         shift += 7;
+         continue;
+      }
+      value += delta;
+      out.push_back (value);
+      delta = 0;
+      shift = 0;
+   }
+}
+
+void word_index::encode (const vector<size_t>& nrs, postings& list) {
+   list.bytes.clear();
+   size_t prev {0};
+   for (const size_t nr: nrs) {
+      put_varint (list.bytes, nr - prev);
+      prev = nr;
+   }
+   list.last = prev;
+   list.count = nrs.size();
+}
+
+void word_index::insert_one (size_t inode_nr, const string& word) {
+   postings& list = index[word];
+   if (list.count == 0 or inode_nr > list.last) {
+      // Inode numbers only grow, so new files append in O(1).
+      put_varint (list.bytes, inode_nr - list.last);
+      list.last = inode_nr;
+      ++list.count;
+      return;
+   }
+   vector<size_t> nrs;
+   decode (list, nrs);
+   auto pos = lower_bound (nrs.begin(), nrs.end(), inode_nr);
+   if (pos != nrs.end() and *pos == inode_nr) return;
+   nrs.insert (pos, inode_nr);
+   encode (nrs, list);
+}
+
+void word_index::erase_one (size_t inode_nr, const string& word) {
+   auto found = index.find (word);
+   if (found == index.end()) return;
+   vector<size_t> nrs;
+   decode (found->second, nrs);
+   auto pos = lower_bound (nrs.begin(), nrs.end(), inode_nr);
+   if (pos == nrs.end() or *pos != inode_nr) return;
+   nrs.erase (pos);
+   if (nrs.empty()) index.erase (found);
+               else encode (nrs, found->second);
+}
+
+vector<size_t> word_index::search (const wordvec& words) const {
+   // Intersect starting from the shortest postings list so the
+   // working set only ever shrinks.
+   vector<const postings*> lists;
+   for (const string* word: unique_words (words)) {
+      auto found = index.find (*word);
+      if (found == index.end()) return {};
+      lists.push_back (&found->second);
+   }
+   if (lists.empty()) return {};
+   sort (lists.begin(), lists.end(),
+         [] (const postings* a, const postings* b) {
+            return a->count < b->count;
+         });
+   vector<size_t> result;
+   decode (*lists.front(), result);
+   vector<size_t> other;
+   vector<size_t> merged;
+   for (auto list = lists.begin() + 1;
+         list != lists.end() and not result.empty(); ++list) {
+      decode (**list, other);
+      merged.clear();
+      set_intersection (result.begin(), result.end(),
+                        other.begin(), other.end(),
+                        back_inserter (merged));
+      result.swap (merged);
+   }
+   return result;
+}
+
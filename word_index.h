@@ -0,0 +1,111 @@
+// $Id: word_index.h,v 1.1 2022-02-06 14:02:11-08 - - $
+
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+#include "util.h"
+
+// class word_index -
+//    Optional inverted index from a word to the inode numbers of the
+//    plain files that contain it.  Each postings list is kept sorted
+//    and stored as deltas packed into varints, so a list of nearby
+//    inode numbers costs about one byte per entry.
+// enable -
+//    The index is off unless enabled before any file is written.
+// insert -
+//    Records that the given words appear in the given inode.
+//    Duplicate words and already recorded inodes are ignored.
+//    Words may be any range of strings (a wordvec or a word_store).
+// erase -
+//    Forgets that the given words appear in the given inode.
+// erase_missing -
+//    After words were cut out of a file, forgets only those of them
+//    that no longer appear in what remains of the file.
+// search -
+//    Returns the sorted inode numbers that contain every word given
+//    (AND semantics), without looking at any file contents.
+
+class word_index {
+   private:
+      struct postings {
+         string bytes;       // varint encoded deltas
+         size_t last {0};    // largest inode number in bytes
+         size_t count {0};
+      };
+      unordered_map<string,postings> index;
+      bool enabled_ {false};
+      static void decode (const postings& list, vector<size_t>& out);
+      static void encode (const vector<size_t>& nrs, postings& list);
+      static void put_varint (string& bytes, size_t value);
+      void insert_one (size_t inode_nr, const string& word);
+      void erase_one (size_t inode_nr, const string& word);
+      template <typename words_t>
+      static vector<const string*> unique_words (const words_t& words);
+   public:
+      bool enabled() const { return enabled_; }
+      void enable (bool on) { enabled_ = on; }
+      template <typename words_t>
+      void insert (size_t inode_nr, const words_t& words);
+      template <typename words_t>
+      void erase (size_t inode_nr, const words_t& words);
+      template <typename words_t>
+      void erase_missing (size_t inode_nr, const wordvec& erased,
+                          const words_t& remaining);
+      vector<size_t> search (const wordvec& words) const;
+};
+
+// unique_words -
+//    Pointers to each distinct word in words, so that a file which
+//    repeats a word only touches that word's postings once.
+
+template <typename words_t>
+vector<const string*> word_index::unique_words (const words_t& words) {
+   vector<const string*> result;
+   for (const auto& word: words) result.push_back (&word);
+   auto less = [] (const string* a, const string* b) { return *a < *b; };
+   auto same = [] (const string* a, const string* b) {
+      return *a == *b;
+   };
+   sort (result.begin(), result.end(), less);
+   result.erase (unique (result.begin(), result.end(), same),
+                 result.end());
+   return result;
+}
+
+template <typename words_t>
+void word_index::insert (size_t inode_nr, const words_t& words) {
+   if (not enabled_) return;
+   for (const string* word: unique_words (words)) {
+      insert_one (inode_nr, *word);
+   }
+}
+
+template <typename words_t>
+void word_index::erase (size_t inode_nr, const words_t& words) {
+   if (not enabled_) return;
+   for (const string* word: unique_words (words)) {
+      erase_one (inode_nr, *word);
+   }
+}
+
+template <typename words_t>
+void word_index::erase_missing (size_t inode_nr, const wordvec& erased,
+                                const words_t& remaining) {
+   if (not enabled_ or erased.empty()) return;
+   unordered_set<string> gone {erased.begin(), erased.end()};
+   for (const auto& word: remaining) {
+      if (gone.empty()) break;
+      gone.erase (word);
+   }
+   for (const auto& word: gone) erase_one (inode_nr, word);
+}
+
+#endif
+
@@ -0,0 +1,219 @@
+// $Id: word_store.cpp,v 1.1 2022-02-06 16:40:27-08 - - $
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+#include "debug.h"
+#include "word_store.h"
+
+// No chunk is ever left empty, so iteration can step from the end of
+// one chunk straight to the first word of the next.
+
+word_store::word_store() {
+   if (content_tier::enabled()) content_tier::admit (*this);
+}
+
+word_store::word_store (const word_store& that):
+            chunks (that.chunks), spans (that.spans),
+            leaves (that.leaves), spanned (that.spanned),
+            words_ (that.words_), chars_ (that.chars_),
+            heap_ (that.heap_) {
+   if (content_tier::enabled()) content_tier::admit (*this);
+}
+
+word_store::~word_store() {
+   if (tier.index != tier_slot::NONE) content_tier::forget (*this);
+}
+
+word_store::span word_store::join (const span& left,
+                                   const span& right) {
+   // Horner's rule over whole chunks: shift left by right's length.
+   return {left.words + right.words,
+           hash_add (hash_mul (left.hash, right.scale), right.hash),
+           hash_mul (left.scale, right.scale)};
+}
+
+word_store::span word_store::chunk_span (const wordvec& chunk) {
+   span result;
+   for (const auto& word: chunk) {
+      result.hash = hash_add (hash_mul (result.hash, HASH_BASE),
+                              word_hash (word));
+   }
+   result.words = chunk.size();
+   result.scale = hash_pow (HASH_BASE, chunk.size());
+   return result;
+}
+
+void word_store::refold (size_t chunk_nr) {
+   for (size_t node = (leaves + chunk_nr) / 2; node > 0; node /= 2) {
+      spans[node] = join (spans[2 * node], spans[2 * node + 1]);
+   }
+}
+
+void word_store::splice_spans (size_t chunk_nr, size_t removed,
+                               const vector<span>& added) {
+   vector<span> row (spans.begin() + leaves,
+                     spans.begin() + leaves + chunk_nr);
+   row.insert (row.end(), added.begin(), added.end());
+   row.insert (row.end(), spans.begin() + leaves + chunk_nr + removed,
+               spans.begin() + leaves + spanned);
+   spanned = row.size();
+   leaves = 0;
+   if (spanned > 0) for (leaves = 1; leaves < spanned; leaves *= 2) {}
+   spans.assign (2 * leaves, span());
+   copy (row.begin(), row.end(), spans.begin() + leaves);
+   for (size_t node = leaves; node-- > 1; ) {
+      spans[node] = join (spans[2 * node], spans[2 * node + 1]);
+   }
+}
+
+pair<size_t, size_t> word_store::find_chunk (size_t pos) const {
+   // The chunk holding pos < size() and pos's offset within it.
+   size_t node {1};
+   while (node < leaves) {
+      node *= 2;
+      if (pos >= spans[node].words) {
+         pos -= spans[node].words;
+         ++node;
+      }
+   }
+   return {node - leaves, pos};
+}
+
+word_store::const_iterator word_store::at (size_t pos) const {
+   if (pos >= words_) return end();
+   auto [chunk_nr, offset] = find_chunk (pos);
+   return {&chunks, chunk_nr, offset};
+}
+
+void word_store::split_chunk (size_t chunk_nr) {
+   wordvec big {move (chunks[chunk_nr])};
+   vector<wordvec> pieces;
+   for (size_t from = 0; from < big.size(); from += CHUNK_WORDS) {
+      size_t to = min (big.size(), from + CHUNK_WORDS);
+      pieces.emplace_back (make_move_iterator (big.begin() + from),
+                           make_move_iterator (big.begin() + to));
+   }
+   chunks.erase (chunks.begin() + chunk_nr);
+   vector<span> added;
+   for (const auto& piece: pieces) added.push_back (chunk_span (piece));
+   chunks.insert (chunks.begin() + chunk_nr,
+                  make_move_iterator (pieces.begin()),
+                  make_move_iterator (pieces.end()));
+   splice_spans (chunk_nr, 1, added);
+}
+
+void word_store::assign (wordvec&& words) {
+   size_t old_bytes {bytes()};
+   chunks.clear();
+   spans.clear();
+   leaves = 0;
+   spanned = 0;
+   words_ = 0;
+   chars_ = 0;
+   heap_ = 0;
+   report (old_bytes);
+   append (move (words));
+}
+
+void word_store::append (wordvec&& words) {
+   DEBUGF ('w', "append " << words.size() << " words");
+   if (words.empty()) return;
+   size_t old_bytes {bytes()};
+   for (auto& word: words) {
+      if (chunks.empty() or chunks.back().size() >= 2 * CHUNK_WORDS) {
+         if (not chunks.empty()) refold (chunks.size() - 1);
+         chunks.emplace_back();
+         chunks.back().reserve (2 * CHUNK_WORDS);
+         if (spanned < leaves) {
+            // An empty leaf changes none of the nodes above it.
+            ++spanned;
+         } else {
+            splice_spans (spanned, 0, {span()});
+         }
+      }
+      span& last = spans[leaves + chunks.size() - 1];
+      last.hash = hash_add (hash_mul (last.hash, HASH_BASE),
+                            word_hash (word));
+      last.scale = hash_mul (last.scale, HASH_BASE);
+      ++last.words;
+      chars_ += word.size();
+      heap_ += heap_bytes (word);
+      ++words_;
+      chunks.back().push_back (move (word));
+   }
+   refold (chunks.size() - 1);
+   report (old_bytes);
+}
+
+void word_store::insert (size_t pos, wordvec&& words) {
+   if (pos > words_) throw out_of_range ("word_store::insert");
+   if (pos == words_) {
+      append (move (words));
+      return;
+   }
+   if (words.empty()) return;
+   size_t old_bytes {bytes()};
+   auto [chunk_nr, offset] = find_chunk (pos);
+   wordvec& chunk = chunks[chunk_nr];
+   for (const auto& word: words) {
+      chars_ += word.size();
+      heap_ += heap_bytes (word);
+   }
+   words_ += words.size();
+   chunk.insert (chunk.begin() + offset,
+                 make_move_iterator (words.begin()),
+                 make_move_iterator (words.end()));
+   if (chunk.size() > 2 * CHUNK_WORDS) {
+      split_chunk (chunk_nr);
+   } else {
+      spans[leaves + chunk_nr] = chunk_span (chunk);
+      refold (chunk_nr);
+   }
+   report (old_bytes);
+}
+
+wordvec word_store::erase (size_t pos, size_t count) {
+   if (pos > words_ or count > words_ - pos) {
+      throw out_of_range ("word_store::erase");
+   }
+   wordvec erased;
+   erased.reserve (count);
+   if (count == 0) return erased;
+   size_t old_bytes {bytes()};
+   auto [chunk_nr, offset] = find_chunk (pos);
+   // Only the chunks between the first and last touched can empty,
+   // so they are dropped together at the end.
+   size_t first_empty {0};
+   size_t emptied {0};
+   while (count > 0) {
+      wordvec& chunk = chunks[chunk_nr];
+      size_t take = min (count, chunk.size() - offset);
+      auto first = chunk.begin() + offset;
+      for (auto word = first; word != first + take; ++word) {
+         chars_ -= word->size();
+         heap_ -= heap_bytes (*word);
+         erased.push_back (move (*word));
+      }
+      chunk.erase (first, first + take);
+      words_ -= take;
+      count -= take;
+      if (chunk.empty()) {
+         if (emptied++ == 0) first_empty = chunk_nr;
+      } else {
+         spans[leaves + chunk_nr] = chunk_span (chunk);
+         refold (chunk_nr);
+      }
+      ++chunk_nr;
+      offset = 0;
+   }
+   if (emptied > 0) {
+      chunks.erase (chunks.begin() + first_empty,
+                    chunks.begin() + first_empty + emptied);
+      splice_spans (first_empty, emptied, {});
+   }
+   report (old_bytes);
+   return erased;
+}
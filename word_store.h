@@ -0,0 +1,178 @@
+// $Id: word_store.h,v 1.1 2022-02-06 16:40:27-08 - - $
+
+#ifndef WORD_STORE_H
+#define WORD_STORE_H
+
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "tiering.h"
+#include "util.h"
+
+// class word_store -
+//    The words of a plain file, held as a sequence of chunks of at
+//    most 2 * CHUNK_WORDS words each, so that an edit only shifts
+//    the words of one chunk instead of the whole file.  Over the
+//    chunks lies a segment tree whose every node holds the word count
+//    and hash of the chunks below it, so finding a word position costs
+//    O(log chunks), and an edit inside one chunk costs its words plus
+//    O(log chunks) to refold the nodes above it.
+//    Only an edit that changes the number of chunks, an insert that
+//    splits one or an erase that empties some, lays the tree out
+//    again in O(chunks), as shifting the chunk table already costs.
+//    A split comes at most once per CHUNK_WORDS words inserted.
+//    Nothing is cached on read, so const members may be called from
+//    several threads at once as long as no one edits the store.
+// assign -
+//    Replaces the contents, taking ownership of the words.
+// append -
+//    Adds words at the end in amortized O(1) per word, plus
+//    O(log chunks) for each chunk it fills.
+// insert -
+//    Inserts words before word position pos (pos == size() appends).
+// erase -
+//    Removes count words starting at pos and returns them.
+// at -
+//    An iterator at word position pos (end() at size()), found by
+//    descending the tree in O(log chunks), so reading a range of words
+//    costs the words read, not the words before them.
+// size -
+//    The number of words.  chars() is the sum of their lengths.
+// bytes -
+//    Approximate heap bytes held: the string objects, their out of
+//    line buffers, the chunk table and the tree.  Kept up to date by
+//    every edit, so it costs O(1).
+// bytes_for -
+//    What bytes() would grow by if words were added.
+// hash -
+//    The polynomial hash of the words in order, which depends only
+//    on the words and not on how they fall into chunks.  It is the
+//    root of the tree, so it costs O(1).
+// Tiering -
+//    While content_tier has a budget, every store is entered in its
+//    ring, and reports each change in bytes().  A spilled store has
+//    no chunks, only its counts and tree, so the
+//    owner must call content_tier::touch or page_in before using its
+//    words.
+
+class word_store {
+   private:
+      static constexpr size_t CHUNK_WORDS {256};
+      static constexpr uint64_t HASH_BASE {0x1f3d5b79a2c4e681 % HASH_PRIME};
+      struct span {
+         size_t words {0};
+         uint64_t hash {0};
+         uint64_t scale {1};     // HASH_BASE to the power words
+      };
+      vector<wordvec> chunks;
+      vector<span> spans;        // spans[1] the root, leaves at leaves
+      size_t leaves {0};         // a power of two, or 0 if no chunks
+      size_t spanned {0};        // leaves in use, one per chunk
+      size_t words_ {0};
+      size_t chars_ {0};
+      size_t heap_ {0};          // out of line string buffers
+      tier_slot tier;
+      friend class content_tier;
+      static span join (const span& left, const span& right);
+      static span chunk_span (const wordvec& chunk);
+      void report (size_t old_bytes) {
+         if (tier.index != tier_slot::NONE) {
+            content_tier::resized (*this, old_bytes);
+         }
+      }
+      void refold (size_t chunk_nr);
+      void splice_spans (size_t chunk_nr, size_t removed,
+                         const vector<span>& added);
+      pair<size_t, size_t> find_chunk (size_t pos) const;
+      void split_chunk (size_t chunk_nr);
+   public:
+      class const_iterator;
+      word_store();
+      word_store (const word_store& that);
+      word_store& operator= (const word_store&) = delete;
+      ~word_store();
+      void assign (wordvec&& words);
+      void append (wordvec&& words);
+      void insert (size_t pos, wordvec&& words);
+      wordvec erase (size_t pos, size_t count);
+      size_t size() const { return words_; }
+      size_t chars() const { return chars_; }
+      bool empty() const { return words_ == 0; }
+      size_t bytes() const {
+         return words_ * sizeof (string) + heap_
+              + spanned * sizeof (wordvec) + spans.size() * sizeof (span);
+      }
+      uint64_t hash() const { return spans.empty() ? 0 : spans[1].hash; }
+      static size_t heap_bytes (const string& word) {
+         // Short strings live inside the string object itself.
+         static const size_t inline_capacity {string().capacity()};
+         return word.capacity() > inline_capacity
+              ? word.capacity() + 1 : 0;
+      }
+      static size_t bytes_for (const wordvec& words) {
+         size_t sum {words.size() * sizeof (string)};
+         for (const auto& word: words) sum += heap_bytes (word);
+         return sum;
+      }
+      const_iterator begin() const;
+      const_iterator end() const;
+      const_iterator at (size_t pos) const;
+};
+
+// class word_store::const_iterator -
+//    Forward iterator over the words of every chunk in order.
+
+class word_store::const_iterator {
+   private:
+      friend class word_store;
+      const vector<wordvec>* chunks {nullptr};
+      size_t chunk_nr {0};
+      size_t word_nr {0};
+      const_iterator (const vector<wordvec>* chunks_, size_t chunk_nr_,
+                      size_t word_nr_ = 0):
+                     chunks (chunks_), chunk_nr (chunk_nr_),
+                     word_nr (word_nr_) {}
+   public:
+      using iterator_category = forward_iterator_tag;
+      using value_type = string;
+      using difference_type = ptrdiff_t;
+      using pointer = const string*;
+      using reference = const string&;
+      const_iterator() = default;
+      reference operator*() const {
+         return (*chunks)[chunk_nr][word_nr];
+      }
+      pointer operator->() const { return &**this; }
+      const_iterator& operator++() {
+         if (++word_nr == (*chunks)[chunk_nr].size()) {
+            ++chunk_nr;
+            word_nr = 0;
+         }
+         return *this;
+      }
+      const_iterator operator++ (int) {
+         const_iterator old {*this};
+         ++*this;
+         return old;
+      }
+      bool operator== (const const_iterator& that) const {
+         return chunk_nr == that.chunk_nr and word_nr == that.word_nr;
+      }
+      bool operator!= (const const_iterator& that) const {
+         return not (*this == that);
+      }
+};
+
+inline word_store::const_iterator word_store::begin() const {
+   return {&chunks, 0};
+}
+
+inline word_store::const_iterator word_store::end() const {
+   return {&chunks, chunks.size()};
+}
+
+#endif
+
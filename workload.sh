@@ -0,0 +1,56 @@
+#!/bin/sh
+# $Id: workload.sh,v 1.1 2022-02-16 14:27:50-08 - - $
+#
+# workload.sh [passes [seed]] -
+#    Writes a yshell script on stdout that works the way a shell
+#    session does on a large tree, for PGO training and for timing
+#    builds.  populate makes a tree of 585 dirs and 5850 files, and
+#    each pass walks it with cd, listing every dir with ls and reading
+#    every file with cat, and in each leaf dir makes, appends to,
+#    mkdirs and removes, leaving the tree as it found it.  seed picks
+#    the file contents and the words written.
+#
+
+passes=${1:-1}
+seed=${2:-1}
+
+awk -v passes="$passes" -v seed="$seed" '
+function words(count,   line, nr) {
+   line = ""
+   for (nr = 0; nr < count; ++nr) {
+      line = line " w" int(rand() * 5000)
+   }
+   return line
+}
+function walk(level,   dir, file) {
+   print "ls"
+   for (file = 0; file < 10; ++file) print "cat f" file
+   if (level == 3) {
+      print "make new" words(20)
+      print "append new" words(10)
+      print "cat new"
+      print "mkdir sub"
+      print "cd sub"
+      print "make a" words(5)
+      print "ls"
+      print "rm a"
+      print "cd .."
+      print "rm sub"
+      print "rm new"
+      return
+   }
+   for (dir = 0; dir < 8; ++dir) {
+      print "cd d" dir
+      walk(level + 1)
+      print "cd .."
+   }
+}
+BEGIN {
+   srand(seed)
+   print "populate t 8 3 10 5-40 " seed
+   for (pass = 0; pass < passes; ++pass) {
+      print "cd t"
+      walk(0)
+      print "cd /"
+   }
+}'
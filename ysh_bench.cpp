@@ -0,0 +1,230 @@
+// $Id: ysh_bench.cpp,v 1.1 2022-02-14 11:02:37-08 - - $
+
+// ysh_bench -
+//    Times the same workload driven through the library API and
+//    through command text, as a program that runs yshell commands and
+//    parses what they print would drive it.  Each path gets a fresh
+//    inode_state.  The phases are: create (mkdir and make of every
+//    file), read (cat of every file, each word counted), and list
+//    (ls of every directory, each entry parsed).
+//    Options: -d dirs, -f files per dir, -w words per file.
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "fs_api.h"
+#include "util.h"
+
+struct bench_options {
+   size_t dirs {100};
+   size_t files {100};
+   size_t words {50};
+};
+
+// phase_result -
+//    How long a phase took, and what it saw, which must agree
+//    between the two paths.
+
+struct phase_result {
+   double seconds {0};
+   size_t items {0};
+};
+
+using contents = vector<wordvec>;  // words of file f, for every dir
+
+static contents make_contents (const bench_options& options) {
+   contents files (options.files);
+   uint64_t seed {12345};
+   for (auto& words: files) {
+      for (size_t nr = 0; nr < options.words; ++nr) {
+         seed = seed * 6364136223846793005 + 1442695040888963407;
+         words.push_back ("w" + to_string ((seed >> 33) % 5000));
+      }
+   }
+   return files;
+}
+
+static string dir_name (size_t nr) { return "d" + to_string (nr); }
+static string file_name (size_t nr) { return "f" + to_string (nr); }
+
+template <typename phase_fn>
+static phase_result timed (phase_fn phase) {
+   auto start = chrono::steady_clock::now();
+   phase_result result;
+   result.items = phase();
+   result.seconds = chrono::duration<double> (
+                    chrono::steady_clock::now() - start).count();
+   return result;
+}
+
+// run_text -
+//    Runs one command line as the shell would, returning its output.
+
+static string run_text (inode_state& state, const string& line) {
+   wordvec words {split (line, " \t")};
+   istringstream no_input;
+   ostringstream out;
+   command_io io {no_input, out};
+   fs_status status {find_command_fn (words.at(0)) (state, words, io)};
+   if (not status.ok()) throw command_error (status.message());
+   return out.str();
+}
+
+static vector<phase_result> text_path (const bench_options& options,
+                                       const contents& files) {
+   inode_state state;
+   vector<phase_result> results;
+   results.push_back (timed ([&] {
+      for (size_t dir = 0; dir < options.dirs; ++dir) {
+         run_text (state, "mkdir " + dir_name (dir));
+         run_text (state, "cd " + dir_name (dir));
+         for (size_t file = 0; file < options.files; ++file) {
+            string line {"make " + file_name (file)};
+            for (const auto& word: files[file]) line += " " + word;
+            run_text (state, line);
+         }
+         run_text (state, "cd ..");
+      }
+      return options.dirs * options.files;
+   }));
+   results.push_back (timed ([&] {
+      size_t words {0};
+      for (size_t dir = 0; dir < options.dirs; ++dir) {
+         run_text (state, "cd " + dir_name (dir));
+         for (size_t file = 0; file < options.files; ++file) {
+            words += split (run_text (state, "cat " + file_name (file)),
+                            " \n").size();
+         }
+         run_text (state, "cd ..");
+      }
+      return words;
+   }));
+   results.push_back (timed ([&] {
+      size_t entries {0};
+      for (size_t dir = 0; dir < options.dirs; ++dir) {
+         istringstream listing {run_text (state, "ls " + dir_name (dir))};
+         string line;
+         getline (listing, line);  // "dN:"
+         size_t inode_nr;
+         size_t size;
+         string name;
+         while (listing >> inode_nr >> size >> name) ++entries;
+      }
+      return entries;
+   }));
+   return results;
+}
+
+static vector<phase_result> api_path (const bench_options& options,
+                                      const contents& files) {
+   inode_state state;
+   fs_api api {state};
+   wordvec dir_names;
+   wordvec file_names;
+   for (size_t dir = 0; dir < options.dirs; ++dir) {
+      dir_names.push_back (dir_name (dir));
+   }
+   for (size_t file = 0; file < options.files; ++file) {
+      file_names.push_back (file_name (file));
+   }
+   auto check = [] (const vector<fs_status>& statuses) {
+      for (const auto& status: statuses) {
+         if (not status.ok()) throw command_error (status.message());
+      }
+   };
+   vector<phase_result> results;
+   results.push_back (timed ([&] {
+      inode_ptr root {api.open_dir ("/")};
+      check (api.make_dirs (root, dir_names));
+      for (const auto& name: dir_names) {
+         vector<fs_file> batch;
+         batch.reserve (options.files);
+         for (size_t file = 0; file < options.files; ++file) {
+            batch.push_back ({file_names[file], files[file]});
+         }
+         check (api.write (api.open_dir ("/" + name), move (batch)));
+      }
+      return options.dirs * options.files;
+   }));
+   results.push_back (timed ([&] {
+      size_t words {0};
+      for (const auto& name: dir_names) {
+         for (const word_store* view:
+              api.read (api.open_dir ("/" + name), file_names)) {
+            words += view->size();
+         }
+      }
+      return words;
+   }));
+   results.push_back (timed ([&] {
+      size_t entries {0};
+      for (const auto& name: dir_names) {
+         entries += api.list (api.open_dir ("/" + name)).size();
+      }
+      return entries;
+   }));
+   return results;
+}
+
+static bench_options scan_options (int argc, char** argv) {
+   bench_options options;
+   opterr = 0;
+   for (;;) {
+      int option {getopt (argc, argv, "d:f:w:")};
+      if (option == EOF) break;
+      try {
+         switch (option) {
+            case 'd': options.dirs = stoul (optarg); break;
+            case 'f': options.files = stoul (optarg); break;
+            case 'w': options.words = stoul (optarg); break;
+            default:
+               complain() << "-" << static_cast<char> (optopt)
+                          << ": invalid option" << endl;
+               break;
+         }
+      } catch (exception&) {
+         complain() << "-" << static_cast<char> (option) << " "
+                    << optarg << ": not a count" << endl;
+      }
+   }
+   return options;
+}
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   bench_options options {scan_options (argc, argv)};
+   if (exec::status() != 0) return exec::status();
+   contents files {make_contents (options)};
+   cout << options.dirs << " dirs, " << options.files << " files each, "
+        << options.words << " words per file" << endl;
+   vector<phase_result> text;
+   vector<phase_result> api;
+   try {
+      text = text_path (options, files);
+      api = api_path (options, files);
+   } catch (runtime_error& error) {
+      complain() << error.what() << endl;
+      return exec::status();
+   }
+   static const char* const phases[] {"create", "read", "list"};
+   cout << left << setw (8) << "phase" << right << setw (12) << "text s"
+        << setw (12) << "api s" << setw (10) << "speedup" << endl;
+   for (size_t nr = 0; nr < text.size(); ++nr) {
+      if (text[nr].items != api[nr].items) {
+         complain() << phases[nr] << ": text saw " << text[nr].items
+                    << ", api saw " << api[nr].items << endl;
+      }
+      cout << left << setw (8) << phases[nr] << right << fixed
+           << setprecision (4) << setw (12) << text[nr].seconds
+           << setw (12) << api[nr].seconds << setprecision (1)
+           << setw (9) << text[nr].seconds / api[nr].seconds << "x"
+           << endl;
+   }
+   return exec::status();
+}
+
@@ -0,0 +1,217 @@
+// $Id: ysh_replay.cpp,v 1.1 2022-02-17 10:04:31-08 - - $
+
+// ysh_replay -
+//    Replays a trace recorded with yshell -t against a fresh
+//    inode_state, with the trace's -i and -m settings, and reports
+//    the latency percentiles of each line as recorded and as
+//    replayed.  Lines start at the pace they were recorded, or with
+//    -s speed that many times faster, or with -s 0 as fast as
+//    possible.  What the lines print is formatted and thrown away.
+//    Replaying one trace with the ysh_replay of two builds, or before
+//    and after a change, compares them under the recorded load.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "pipeline.h"
+#include "tiering.h"
+#include "trace.h"
+#include "util.h"
+
+struct replay_options {
+   double speed {1};   // 0: as fast as possible
+   string trace_from;
+};
+
+// class null_outbuf -
+//    Output streambuf that accepts everything and keeps nothing.
+
+class null_outbuf: public streambuf {
+   private:
+      char buffer[4096];
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         setp (buffer, buffer + sizeof buffer);
+         return traits_type::not_eof (ch);
+      }
+};
+
+// replay_result -
+//    The latency of each line replayed, and how it went.
+
+struct replay_result {
+   vector<uint64_t> latency_ns;
+   size_t failed {0};
+   uint64_t most_late_ns {0};   // worst start behind the recorded pace
+   double seconds {0};
+};
+
+static replay_result replay (const trace_file& trace, double speed) {
+   inode_state state;
+   state.get_word_index().enable (trace.word_index);
+   if (trace.memory > 0) content_tier::budget (trace.memory);
+
+   replay_result result;
+   result.latency_ns.reserve (trace.records.size());
+   auto nanoseconds = [] (trace_clock::duration span) {
+      return static_cast<uint64_t> (
+             chrono::duration_cast<chrono::nanoseconds> (span).count());
+   };
+   auto origin = trace_clock::now();
+   for (const auto& record: trace.records) {
+      if (speed > 0) {
+         auto due = origin + chrono::nanoseconds (static_cast<int64_t> (
+                             static_cast<double> (record.start_ns) / speed));
+         auto now = trace_clock::now();
+         if (now < due) {
+            this_thread::sleep_until (due);
+         } else {
+            result.most_late_ns = max (result.most_late_ns,
+                                       nanoseconds (now - due));
+         }
+      }
+      auto start = trace_clock::now();
+      bool failed {true};
+      bool exited {false};
+      try {
+         wordvec words {split (record.line, " \t")};
+         failed = not run_pipeline (state, split_pipeline (words)).ok();
+      } catch (command_error&) {
+      } catch (file_error&) {
+      } catch (ysh_exit&) {
+         failed = false;
+         exited = true;
+      }
+      content_tier::enforce();
+      result.latency_ns.push_back (nanoseconds (trace_clock::now()
+                                                - start));
+      if (failed) ++result.failed;
+      if (exited) break;
+   }
+   result.seconds = chrono::duration<double> (trace_clock::now()
+                                              - origin).count();
+   return result;
+}
+
+static double percentile_us (vector<uint64_t>& latency_ns,
+                             double percent) {
+   // nearest rank, on latencies already sorted
+   if (latency_ns.empty()) return 0;
+   size_t rank = static_cast<size_t> (
+                 ceil (percent / 100 * static_cast<double> (
+                       latency_ns.size())));
+   return static_cast<double> (latency_ns[max<size_t> (rank, 1) - 1])
+          / 1000;
+}
+
+static replay_options scan_options (int argc, char** argv) {
+   replay_options options;
+   opterr = 0;
+   for (;;) {
+      int option {getopt (argc, argv, "s:")};
+      if (option == EOF) break;
+      try {
+         switch (option) {
+            case 's':
+               options.speed = stod (optarg);
+               if (options.speed < 0) throw invalid_argument (optarg);
+               break;
+            default:
+               complain() << "-" << static_cast<char> (optopt)
+                          << ": invalid option" << endl;
+               break;
+         }
+      } catch (exception&) {
+         complain() << "-s " << optarg << ": not a speed" << endl;
+      }
+   }
+   if (optind + 1 != argc) {
+      complain() << "usage: " << exec::execname()
+                 << " [-s speed] tracefile" << endl;
+   } else {
+      options.trace_from = argv[optind];
+   }
+   return options;
+}
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   replay_options options {scan_options (argc, argv)};
+   if (exec::status() != 0) return exec::status();
+   trace_file trace;
+   try {
+      ifstream in (options.trace_from, ios::binary);
+      if (not in) throw runtime_error ("cannot open");
+      trace = load_trace (in);
+   } catch (exception& error) {
+      complain() << options.trace_from << ": " << error.what() << endl;
+      return exec::status();
+   }
+
+   // the lines' output and complaints cost what they would in the
+   // shell, short of the terminal
+   null_outbuf discard;
+   streambuf* saved_out = cout.rdbuf (&discard);
+   streambuf* saved_err = cerr.rdbuf (&discard);
+   int saved_status = exec::status();
+   replay_result replayed {replay (trace, options.speed)};
+   cout.rdbuf (saved_out);
+   cerr.rdbuf (saved_err);
+   exec::status (saved_status);
+
+   vector<uint64_t> recorded;
+   size_t recorded_failed {0};
+   for (const auto& record: trace.records) {
+      recorded.push_back (record.latency_ns);
+      if (record.failed) ++recorded_failed;
+   }
+   double span = trace.records.empty() ? 0
+               : static_cast<double> (trace.records.back().start_ns
+                                      + trace.records.back().latency_ns)
+                 / 1e9;
+   sort (recorded.begin(), recorded.end());
+   sort (replayed.latency_ns.begin(), replayed.latency_ns.end());
+
+   cout << options.trace_from << ": " << trace.records.size()
+        << " lines over " << fixed << setprecision (3) << span
+        << " s, replayed ";
+   if (options.speed == 0) {
+      cout << "as fast as possible" << endl;
+   } else {
+      cout << "at " << defaultfloat << options.speed
+           << "x the recorded pace" << endl;
+   }
+   cout << left << setw (10) << "" << right << setw (14) << "recorded"
+        << setw (14) << "replayed" << endl;
+   cout << left << setw (10) << "lines" << right << setw (14)
+        << recorded.size() << setw (14) << replayed.latency_ns.size()
+        << endl;
+   cout << left << setw (10) << "failed" << right << setw (14)
+        << recorded_failed << setw (14) << replayed.failed << endl;
+   static const pair<const char*, double> percentiles[] {
+      {"p50 us", 50}, {"p90 us", 90}, {"p99 us", 99},
+      {"p99.9 us", 99.9}, {"max us", 100},
+   };
+   for (const auto& [name, percent]: percentiles) {
+      cout << left << setw (10) << name << right << fixed
+           << setprecision (1) << setw (14)
+           << percentile_us (recorded, percent) << setw (14)
+           << percentile_us (replayed.latency_ns, percent) << endl;
+   }
+   cout << left << setw (10) << "wall s" << right << setprecision (3)
+        << setw (14) << span << setw (14) << replayed.seconds << endl;
+   if (options.speed > 0) {
+      cout << "most late start: " << setprecision (1)
+           << static_cast<double> (replayed.most_late_ns) / 1000
+           << " us" << endl;
+   }
+   return exec::status();
+}
+